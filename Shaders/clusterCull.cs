@@ -0,0 +1,236 @@
+#version 430
+#include "frame.in"
+#include "light.in"
+#include "cluster.in"
+#include "tileStats.in"
+#include "listPool.in"
+#include "frustumLight.in"
+
+// Each tile has room for reservedLights list entries at the start of
+// the buffer. Longer lists are allocated from the pool after those
+uniform uint reservedLights;
+uniform uint poolCapacity;
+
+// Lights of the tile kept in shared memory. Tiles with more are still
+// counted in full, and find their lights in the frustum list again
+// when filling their lists
+#define MAX_TILE_LIGHTS 2048
+#define MAX_SLICES 64
+
+shared vec4 frustumPlanes[4];
+shared uint tileLights[MAX_TILE_LIGHTS];
+shared uint nTileLights;
+shared uint sliceCounts[MAX_SLICES];
+shared uint sliceOffsets[MAX_SLICES];
+shared uint sliceFill[MAX_SLICES];
+shared uint baseOffset;
+
+// One workgroup per screen tile. Lights are first culled against the
+// tile's side planes, then binned into the depth slices they overlap
+layout (local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+bool isLightInTile(uint index)
+{
+	vec4 position = view * vec4(lightBuffer.lights[index].positionRadius.xyz, 1.0);
+	float radius = lightBuffer.lights[index].positionRadius.w;
+
+	if (-position.z + radius < 0.0 || -position.z - radius > clusterFar) return false;
+
+	for (int j = 0; j < 4; j++)
+	{
+		if (dot(position, frustumPlanes[j]) + radius < 0.0) return false;
+	}
+
+	return true;
+}
+
+void getLightSlices(uint index, out uint firstSlice, out uint lastSlice)
+{
+	float depth = -(view * vec4(lightBuffer.lights[index].positionRadius.xyz, 1.0)).z;
+	float radius = lightBuffer.lights[index].positionRadius.w;
+
+	firstSlice = getClusterSlice(depth - radius);
+	lastSlice = getClusterSlice(depth + radius);
+}
+
+void addLightToSlices(uint index)
+{
+	uint firstSlice, lastSlice;
+	getLightSlices(index, firstSlice, lastSlice);
+
+	for (uint s = firstSlice; s <= lastSlice; s++)
+	{
+		uint sliceLightIndex = atomicAdd(sliceFill[s], 1);
+		if (sliceLightIndex < sliceCounts[s])
+		{
+			clusterLightBuffer.indices[baseOffset + sliceOffsets[s] + sliceLightIndex] = index;
+		}
+	}
+}
+
+// Cuts the slice counts down to add up to capacity. Slices shorter
+// than the cut keep all their lights, and the room they leave goes
+// to the longer ones, rather than every slice getting an even share
+void fitSlices(uint capacity)
+{
+	// Find the highest cut that still fits
+	uint low = 0;
+	uint high = capacity;
+	while (low < high)
+	{
+		uint cut = (low + high + 1) / 2;
+		uint total = 0;
+		for (uint s = 0; s < clusterCount.z; s++)
+		{
+			total += min(sliceCounts[s], cut);
+		}
+
+		if (total <= capacity) low = cut;
+		else high = cut - 1;
+	}
+
+	uint total = 0;
+	for (uint s = 0; s < clusterCount.z; s++)
+	{
+		total += min(sliceCounts[s], low);
+	}
+
+	// One more light for some of the cut slices, to fill what is left
+	uint spare = capacity - total;
+	for (uint s = 0; s < clusterCount.z; s++)
+	{
+		if (sliceCounts[s] <= low) continue;
+
+		sliceCounts[s] = low;
+		if (spare > 0)
+		{
+			sliceCounts[s]++;
+			spare--;
+		}
+	}
+}
+
+void main()
+{
+	uint threadCount = gl_WorkGroupSize.x;
+
+	if (gl_LocalInvocationIndex == 0)
+	{
+		nTileLights = 0;
+
+		// Calculate scale and bias
+		vec2 tileScale = screenSize / float(2 * clusterTileSize);
+		vec2 tileBias = tileScale - vec2(gl_WorkGroupID.xy);
+
+		vec4 col1 = vec4(-projection[0][0] * tileScale.x, projection[0][1], tileBias.x, projection[0][3]);
+		vec4 col2 = vec4(projection[1][0], -projection[1][1] * tileScale.y, tileBias.y, projection[1][3]);
+		vec4 col4 = vec4(projection[3][0], projection[3][1],  -1.0f, projection[3][3]);
+
+		frustumPlanes[0] = col4 + col1; // Left plane
+		frustumPlanes[1] = col4 - col1; // Right plane
+		frustumPlanes[2] = col4 - col2; // Top plane
+		frustumPlanes[3] = col4 + col2; // Bottom plane
+
+		for(int i = 0; i < 4; i++)
+		{
+			frustumPlanes[i] /= length(frustumPlanes[i].xyz);
+		}
+	}
+
+	for (uint i = gl_LocalInvocationIndex; i < MAX_SLICES; i += threadCount)
+	{
+		sliceCounts[i] = 0;
+		sliceFill[i] = 0;
+	}
+
+	barrier();
+
+	// Find the lights inside the tile, and count them per slice.
+	// Only lights inside the view frustum can touch the tile
+	uint frustumLightCount = frustumLightBuffer.count;
+	for (uint i = gl_LocalInvocationIndex; i < frustumLightCount; i += threadCount)
+	{
+		uint index = frustumLightBuffer.indices[i];
+		if (!isLightInTile(index)) continue;
+
+		uint tileLightIndex = atomicAdd(nTileLights, 1);
+		if (tileLightIndex < MAX_TILE_LIGHTS) tileLights[tileLightIndex] = index;
+
+		uint firstSlice, lastSlice;
+		getLightSlices(index, firstSlice, lastSlice);
+
+		for (uint s = firstSlice; s <= lastSlice; s++)
+		{
+			atomicAdd(sliceCounts[s], 1);
+		}
+	}
+
+	barrier();
+
+	// Find room for this tile's lists, and lay them out in it
+	if (gl_LocalInvocationIndex == 0)
+	{
+		uint tile = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+
+		uint total = 0;
+		for (uint s = 0; s < clusterCount.z; s++)
+		{
+			total += sliceCounts[s];
+		}
+
+		// The counter keeps going past the end of the pool, so the CPU
+		// can read back how much it needs. Until the pool grows, lists
+		// that don't fit are cut down to the tile's own region rather
+		// than drop the whole tile, and the tile is flagged in the stats
+		baseOffset = tile * reservedLights;
+		bool overflow = false;
+		if (total > reservedLights)
+		{
+			uint poolOffset = atomicAdd(lightListCounterBuffer.count, total);
+			if (poolOffset < poolCapacity && total <= poolCapacity - poolOffset)
+			{
+				baseOffset = gl_NumWorkGroups.x * gl_NumWorkGroups.y * reservedLights + poolOffset;
+			}
+			else
+			{
+				fitSlices(reservedLights);
+				overflow = true;
+			}
+		}
+
+		tileStatsBuffer.tiles[tile] = nTileLights | (overflow? TILE_OVERFLOW: 0u);
+		atomicAdd(lightListCounterBuffer.entries, total);
+		if (overflow) atomicAdd(lightListCounterBuffer.dropped, total - reservedLights);
+
+		uint offset = 0;
+		for (uint s = 0; s < clusterCount.z; s++)
+		{
+			sliceOffsets[s] = offset;
+			offset += sliceCounts[s];
+		}
+	}
+
+	barrier();
+
+	if (nTileLights <= MAX_TILE_LIGHTS)
+	{
+		for (uint i = gl_LocalInvocationIndex; i < nTileLights; i += threadCount)
+		{
+			addLightToSlices(tileLights[i]);
+		}
+	}
+	else
+	{
+		for (uint i = gl_LocalInvocationIndex; i < frustumLightCount; i += threadCount)
+		{
+			uint index = frustumLightBuffer.indices[i];
+			if (isLightInTile(index)) addLightToSlices(index);
+		}
+	}
+
+	for (uint s = gl_LocalInvocationIndex; s < clusterCount.z; s += threadCount)
+	{
+		uint cluster = (s * clusterCount.y + gl_WorkGroupID.y) * clusterCount.x + gl_WorkGroupID.x;
+		clusterGridBuffer.clusters[cluster] = uvec2(baseOffset + sliceOffsets[s], sliceCounts[s]);
+	}
+}
@@ -1,10 +1,10 @@
 #version 430
 
-uniform vec3 ambient;
+in vec3 lightColor;
 
 out vec4 color;
 
 void main()
 {
-	color = vec4(ambient, 1.0);
+	color = vec4(lightColor, 1.0);
 }
@@ -1,11 +1,19 @@
 #version 430
+#include "frame.in"
+#include "light.in"
 
 layout (location = 0) in vec3 position;
 
-uniform mat4 viewProjection;
-uniform mat4 model;
+out vec3 lightColor;
+
+uniform float sphereScale;
 
 void main()
 {
-	gl_Position = viewProjection * model * vec4(position, 1.0);
+	// One instance per light, placed and colored from the light buffer
+	Light light = lightBuffer.lights[gl_InstanceID];
+	vec3 worldPosition = light.positionRadius.xyz + position * sphereScale * light.positionRadius.w;
+
+	lightColor = light.colorSpec.xyz;
+	gl_Position = viewProjection * vec4(worldPosition, 1.0);
 }
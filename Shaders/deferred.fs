@@ -1,10 +1,8 @@
 #version 430
+#include "frame.in"
 #include "light.in"
+#include "gbuffer.in"
 
-uniform vec3 cameraPosition;
-uniform int lightCount;
-
-uniform sampler2D gPosition;
 uniform sampler2D gNormal;
 uniform sampler2D gAlbedoSpec;
 uniform sampler2D depthMap;
@@ -14,17 +12,18 @@ out vec4 color;
 
 void main()
 {
-	if (texture(depthMap, texCoord0).r >= 0.99999) discard;
+	float depth = texture(depthMap, texCoord0).r;
+	if (depth >= 0.99999) discard;
 
-    vec3 fragPos = texture(gPosition, texCoord0).rgb;
-    vec3 normal = texture(gNormal, texCoord0).rgb;
+    vec3 fragPos = reconstructPosition(texCoord0, depth);
+    vec3 normal = decodeNormal(texture(gNormal, texCoord0).rg);
     vec4 albedoSpec = texture(gAlbedoSpec, texCoord0);
 
 	vec3 viewDir = normalize(cameraPosition - fragPos);
 
 	vec3 result = vec3(0.0);
 
-	for (uint i = 0; i <= lightCount; i++)
+	for (uint i = 0; i < lightCount; i++)
 	{
 		result += calcLight(lightBuffer.lights[i], albedoSpec.rgb, albedoSpec.a, normal, viewDir, fragPos);
 	}
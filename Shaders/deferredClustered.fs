@@ -0,0 +1,40 @@
+#version 430
+#include "frame.in"
+#include "light.in"
+#include "gbuffer.in"
+#include "cluster.in"
+
+uniform sampler2D gNormal;
+uniform sampler2D gAlbedoSpec;
+uniform sampler2D depthMap;
+
+in vec2 position0;
+in vec2 texCoord0;
+out vec4 color;
+
+void main()
+{
+	float depth = texture(depthMap, texCoord0).r;
+	if (depth >= 0.99999) discard;
+
+	// We can't use gl_FragCoord because it will mess up tile positions
+	// when using glViewport to render only to part of the screen
+	uint cluster = getClusterIndex((position0 * 0.5 + 0.5) * screenSize, linearizeDepth(depth));
+	uvec2 lightList = clusterGridBuffer.clusters[cluster];
+
+    vec3 fragPos = reconstructPosition(texCoord0, depth);
+    vec3 normal = decodeNormal(texture(gNormal, texCoord0).rg);
+    vec4 albedoSpec = texture(gAlbedoSpec, texCoord0);
+
+	vec3 viewDir = normalize(cameraPosition - fragPos);
+
+	vec3 result = vec3(0.0);
+
+	uint lastInd = lightList.x + lightList.y;
+	for (uint i = lightList.x; i < lastInd; i++)
+	{
+		result += calcLight(lightBuffer.lights[clusterLightBuffer.indices[i]], albedoSpec.rgb, albedoSpec.a, normal, viewDir, fragPos);
+	}
+
+	color = vec4(result, 1.0);
+}
@@ -1,12 +1,11 @@
 #version 430
+#include "frame.in"
+#include "gbuffer.in"
 
-layout (location = 0) out vec3 gPosition;
-layout (location = 1) out vec3 gNormal;
-layout (location = 2) out vec4 gAlbedoSpec;
+layout (location = 0) out vec2 gNormal;
+layout (location = 1) out vec4 gAlbedoSpec;
 
 uniform vec3 ambient;
-uniform vec3 cameraPosition;
-uniform int lightCount;
 uniform int tilesX;
 
 uniform sampler2D texture_diffuse1;
@@ -19,15 +18,14 @@ in mat3 TBN;
 
 void main()
 {
-	vec3 diffuseColor = texture2D(texture_diffuse1, texCoord0).xyz;
-	vec3 specularColor = texture2D(texture_specular1, texCoord0).xyz;
-	vec3 normalColor = normalize(texture2D(texture_normal1, texCoord0).xyz * 2.0 - 1.0);
+	vec3 diffuseColor = texture(texture_diffuse1, texCoord0).xyz;
+	vec3 specularColor = texture(texture_specular1, texCoord0).xyz;
+	vec3 normalColor = normalize(texture(texture_normal1, texCoord0).xyz * 2.0 - 1.0);
 
 	vec3 viewDir = normalize(cameraPosition - fragPosition0);
 	vec3 normal = normalize(TBN * normalColor);
 
-    gPosition = fragPosition0.xyz;
-    gNormal = normal;
+    gNormal = encodeNormal(normal);
     gAlbedoSpec.rgb = diffuseColor;
     gAlbedoSpec.a = specularColor.r;
 }
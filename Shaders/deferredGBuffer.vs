@@ -1,20 +1,23 @@
 #version 430
+#include "frame.in"
 
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec2 texCoord;
 layout (location = 2) in vec3 normal;
 layout (location = 3) in vec3 tangent;
 layout (location = 4) in vec3 bitangent;
+layout (location = 5) in uint meshIndex;
 
 out vec2 texCoord0;
 out vec3 fragPosition0;
 out mat3 TBN;
 
-uniform mat4 viewProjection;
-uniform mat4 model;
+#include "mesh.in"
 
 void main()
 {
+	mat4 model = meshBuffer.meshes[meshIndex].transform;
+
 	gl_Position = viewProjection * model * vec4(position, 1.0);
 	texCoord0 = texCoord;
 	fragPosition0 = (model * vec4(position, 1.0)).xyz;
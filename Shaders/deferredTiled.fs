@@ -1,45 +1,36 @@
 #version 430
+#include "frame.in"
 #include "light.in"
+#include "gbuffer.in"
+#include "tile.in"
 
-uniform vec3 cameraPosition;
-uniform int lightCount;
-uniform int tilesX;
-uniform vec2 screenSize;
-
-uniform sampler2D gPosition;
 uniform sampler2D gNormal;
 uniform sampler2D gAlbedoSpec;
 uniform sampler2D depthMap;
 
-layout (std430, binding = 1) readonly buffer VisibleLightBuffer
-{
-	uint indices[];
-} visibleLightBuffer;
-
 in vec2 position0;
 in vec2 texCoord0;
 out vec4 color;
 
 void main()
 {
-	if (texture(depthMap, texCoord0).r >= 0.99999) discard;
+	float depth = texture(depthMap, texCoord0).r;
+	if (depth >= 0.99999) discard;
 
 	// We can't use gl_FragCoord because it will mess up tile positions
 	// when using glViewport to render only to part of the screen
-	ivec2 tileIndex = ivec2((position0 * 0.5 + 0.5) * screenSize / vec2(16.0, 16.0));
-	uint location = tileIndex.y * tilesX + tileIndex.x;
-	uint offset = location * 1024;
+	uvec2 lightList = tileGridBuffer.tiles[getTileIndex((position0 * 0.5 + 0.5) * screenSize)];
 
-    vec3 fragPos = texture(gPosition, texCoord0).rgb;
-    vec3 normal = texture(gNormal, texCoord0).rgb;
+    vec3 fragPos = reconstructPosition(texCoord0, depth);
+    vec3 normal = decodeNormal(texture(gNormal, texCoord0).rg);
     vec4 albedoSpec = texture(gAlbedoSpec, texCoord0);
 
 	vec3 viewDir = normalize(cameraPosition - fragPos);
 
 	vec3 result = vec3(0.0);
 
-	uint lastInd = offset + 1023;
-	for (uint i = offset; i <= lastInd && visibleLightBuffer.indices[i] != -1; i++)
+	uint lastInd = lightList.x + lightList.y;
+	for (uint i = lightList.x; i < lastInd; i++)
 	{
 		result += calcLight(lightBuffer.lights[visibleLightBuffer.indices[i]], albedoSpec.rgb, albedoSpec.a, normal, viewDir, fragPos);
 	}
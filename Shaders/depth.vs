@@ -1,11 +1,14 @@
 #version 430
+#include "frame.in"
 
 layout (location = 0) in vec3 position;
+layout (location = 5) in uint meshIndex;
 
-uniform mat4 viewProjection;
-uniform mat4 model;
+#include "mesh.in"
 
 void main()
 {
+	mat4 model = meshBuffer.meshes[meshIndex].transform;
+
 	gl_Position = viewProjection * model * vec4(position, 1.0);
 }
@@ -1,6 +1,6 @@
 #version 430
 
-uniform sampler2D texture;
+uniform sampler2D fontTexture;
 
 in vec2 texCoord0;
 
@@ -8,5 +8,5 @@ out vec4 color;
 
 void main()
 {
-	color = texture2D(texture, texCoord0);
+	color = texture(fontTexture, texCoord0);
 }
@@ -1,9 +1,7 @@
 #version 430
+#include "frame.in"
 #include "light.in"
 
-uniform vec3 cameraPosition;
-uniform int lightCount;
-
 uniform sampler2D texture_diffuse1;
 uniform sampler2D texture_specular1;
 uniform sampler2D texture_normal1;
@@ -16,16 +14,16 @@ out vec4 color;
 
 void main()
 {
-	vec3 diffuseColor = texture2D(texture_diffuse1, texCoord0).xyz;
-	float specularIntensity = texture2D(texture_specular1, texCoord0).r;
-	vec3 normalColor = normalize(texture2D(texture_normal1, texCoord0).xyz * 2.0 - 1.0);
+	vec3 diffuseColor = texture(texture_diffuse1, texCoord0).xyz;
+	float specularIntensity = texture(texture_specular1, texCoord0).r;
+	vec3 normalColor = normalize(texture(texture_normal1, texCoord0).xyz * 2.0 - 1.0);
 
 	vec3 viewDir = normalize(cameraPosition - fragPosition0);
 	vec3 normal = normalize(TBN * normalColor);
 
 	vec3 result = vec3(0.0);
 
-	for (uint i = 0; i <= lightCount; i++)
+	for (uint i = 0; i < lightCount; i++)
 	{
 		result += calcLight(lightBuffer.lights[i], diffuseColor, specularIntensity, normal, viewDir, fragPosition0);
 	}
@@ -0,0 +1,37 @@
+#version 430
+#include "frame.in"
+#include "light.in"
+#include "cluster.in"
+
+uniform sampler2D texture_diffuse1;
+uniform sampler2D texture_specular1;
+uniform sampler2D texture_normal1;
+
+in vec2 texCoord0;
+in vec3 fragPosition0;
+in mat3 TBN;
+
+out vec4 color;
+
+void main()
+{
+	uint cluster = getClusterIndex(gl_FragCoord.xy, linearizeDepth(gl_FragCoord.z));
+	uvec2 lightList = clusterGridBuffer.clusters[cluster];
+
+	vec3 diffuseColor = texture(texture_diffuse1, texCoord0).xyz;
+	float specularIntensity = texture(texture_specular1, texCoord0).r;
+	vec3 normalColor = normalize(texture(texture_normal1, texCoord0).xyz * 2.0 - 1.0);
+
+	vec3 viewDir = normalize(cameraPosition - fragPosition0);
+	vec3 normal = normalize(TBN * normalColor);
+
+	vec3 result = vec3(0.0);
+
+	uint lastInd = lightList.x + lightList.y;
+	for (uint i = lightList.x; i < lastInd; i++)
+	{
+		result += calcLight(lightBuffer.lights[clusterLightBuffer.indices[i]], diffuseColor, specularIntensity, normal, viewDir, fragPosition0);
+	}
+
+	color = vec4(result, 1.0);
+}
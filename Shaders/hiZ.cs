@@ -0,0 +1,45 @@
+#version 430
+
+// Builds one level of the Hi-Z pyramid. Every texel holds the
+// farthest depth of the texels it covers in the level below.
+// With COPY_DEPTH, level 0 is copied from the depth buffer
+layout (local_size_x = 8, local_size_y = 8) in;
+
+#ifdef COPY_DEPTH
+uniform sampler2D depthMap;
+#else
+layout (r32f, binding = 0) readonly uniform image2D source;
+#endif
+layout (r32f, binding = 1) writeonly uniform image2D destination;
+
+void main()
+{
+	ivec2 position = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = imageSize(destination);
+
+	if (position.x >= size.x || position.y >= size.y) return;
+
+#ifdef COPY_DEPTH
+	float depth = texelFetch(depthMap, position, 0).r;
+#else
+	// When the level below has an odd size, the last row
+	// and column also cover the texels left over
+	ivec2 sourceSize = imageSize(source);
+	ivec2 first = position * 2;
+	ivec2 last = first + 1;
+	if (position.x == size.x - 1 && (sourceSize.x & 1) != 0) last.x++;
+	if (position.y == size.y - 1 && (sourceSize.y & 1) != 0) last.y++;
+	last = min(last, sourceSize - 1);
+
+	float depth = 0.0;
+	for (int y = first.y; y <= last.y; y++)
+	{
+		for (int x = first.x; x <= last.x; x++)
+		{
+			depth = max(depth, imageLoad(source, ivec2(x, y)).r);
+		}
+	}
+#endif
+
+	imageStore(destination, position, vec4(depth));
+}
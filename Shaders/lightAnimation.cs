@@ -0,0 +1,76 @@
+#version 430
+#include "frame.in"
+
+struct Light
+{
+	vec4 positionRadius;
+	vec4 colorSpec;
+};
+
+// Where each light is heading, and how many times it picked a new target
+struct LightState
+{
+	vec3 target;
+	uint retargets;
+};
+
+layout (std430, binding = 0) buffer LightBuffer
+{
+	Light lights[];
+} lightBuffer;
+
+layout (std430, binding = 8) buffer LightStateBuffer
+{
+	LightState states[];
+} lightStateBuffer;
+
+uniform float deltaTime;
+uniform uint seed;
+uniform vec3 boxMin;
+uniform vec3 boxMax;
+
+uint pcgHash(uint x)
+{
+	uint state = x * 747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+// Same counter based random numbers as lightRandom in Source/lights.cpp
+float lightRandom(uint index, uint counter, uint component)
+{
+	uint key = pcgHash(index ^ pcgHash(seed));
+	key = pcgHash(key + counter);
+	return float(pcgHash(key + component) >> 8u) * (1.0 / 16777216.0);
+}
+
+// Same motion as moveLights on the CPU: each light moves towards its
+// target at a speed based on its index, and picks a new target inside
+// the model bounds once it's there. Division and length aren't
+// correctly rounded here and may be fused, so positions can drift from
+// the CPU results, and a light may retarget on a different frame
+layout (local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+void main()
+{
+	uint index = gl_GlobalInvocationID.x;
+	if (index >= uint(lightCount)) return;
+
+	vec3 position = lightBuffer.lights[index].positionRadius.xyz;
+	LightState state = lightStateBuffer.states[index];
+
+	vec3 toTarget = state.target - position;
+	position += toTarget * (deltaTime * (float(index % 1024u) / 100.0) / length(toTarget));
+
+	toTarget = state.target - position;
+	if (dot(toTarget, toTarget) < 0.1)
+	{
+		state.retargets++;
+		state.target = boxMin + (boxMax - boxMin) * vec3(lightRandom(index, state.retargets, 0u),
+														 lightRandom(index, state.retargets, 1u),
+														 lightRandom(index, state.retargets, 2u));
+	}
+
+	lightBuffer.lights[index].positionRadius.xyz = position;
+	lightStateBuffer.states[index] = state;
+}
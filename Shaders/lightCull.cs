@@ -1,60 +1,65 @@
 #version 430
 // See https://github.com/bcrusco/Forward-Plus-Renderer/blob/master/Forward-Plus/Forward-Plus/source/shaders/light_culling.comp.glsl
 
-struct Light
-{
-	vec4 positionRadius;
-	vec4 colorSpec;
-};
+#include "frame.in"
+#include "light.in"
+#include "tile.in"
+#include "tileStats.in"
+#include "listPool.in"
+#include "frustumLight.in"
+
+#ifdef SUPER_TILES
+#include "superTile.in"
+#endif
 
-layout (std430, binding = 0) readonly buffer LightBuffer
-{
-	Light lights[];
-} lightBuffer;
+// With SHADE_TILES, the tile's list stays in shared memory and each
+// thread shades its pixel from the GBuffer, instead of writing the
+// list to visibleLightBuffer for deferredTiled.fs
+#ifdef SHADE_TILES
+#include "gbuffer.in"
 
-layout (std430, binding = 1) writeonly buffer VisibleLightBuffer
-{
-	uint indices[];
-} visibleLightBuffer;
+uniform sampler2D gNormal;
+uniform sampler2D gAlbedoSpec;
+uniform vec3 clearColor;
+
+layout (rgba8, binding = 0) writeonly uniform image2D shadedImage;
+#endif
 
 uniform sampler2D depthMap;
-uniform mat4 view;
-uniform mat4 projection;
-uniform vec2 screenSize;
-uniform int lightCount;
-uniform float zNear;
-uniform float zFar;
+uniform bool depthMaskCulling;
+
+// Each tile has room for reservedLights at the start of the buffer,
+// lists longer than that are allocated from the pool after those
+uniform uint reservedLights;
+uniform uint poolCapacity;
 
 shared uint minDepth;
 shared uint maxDepth;
+shared uint depthMask;
 shared vec4 frustumPlanes[6];
 
 shared uint visibleLights[1024];
 shared uint nVisibleLights;
+shared uint visibleLightOffset;
 
-#ifndef WORKGROUP_SIZE
-	#define WORKGROUP_SIZE 16
-#endif
-
-layout (local_size_x = WORKGROUP_SIZE, local_size_y = WORKGROUP_SIZE, local_size_z = 1) in;
+layout (local_size_x = TILE_SIZE, local_size_y = TILE_SIZE, local_size_z = 1) in;
 
 void main()
 {
 	uint location = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
-	uint offset = location * 1024;
-	uvec2 nTiles = (uvec2(screenSize) + uvec2(WORKGROUP_SIZE - 1)) / uvec2(screenSize);
 
 	if (gl_LocalInvocationIndex == 0)
 	{
 		minDepth = 0xFFFFFFFF;
 		maxDepth = 0;
+		depthMask = 0;
 		nVisibleLights = 0;
 	}
 
 	barrier();
 
 	// Calculate min and max depth
-	float depth = texture2D(depthMap, gl_GlobalInvocationID.xy / screenSize).r;
+	float depth = texture(depthMap, gl_GlobalInvocationID.xy / screenSize).r;
 	depth = (0.5 * projection[3][2]) / (depth + 0.5 * projection[2][2] - 0.5);
 
 	atomicMin(minDepth, floatBitsToUint(depth));
@@ -62,6 +67,18 @@ void main()
 
 	barrier();
 
+	// 2.5D culling: split the tile's depth range into 32 slices and
+	// mark the ones holding a pixel, so lights in the empty gap
+	// between a foreground edge and the background can be rejected
+	float tileMinDepth = uintBitsToFloat(minDepth);
+	float sliceScale = 32.0 / max(uintBitsToFloat(maxDepth) - tileMinDepth, 1e-6);
+
+	if (depthMaskCulling)
+	{
+		uint slice = uint(clamp((depth - tileMinDepth) * sliceScale, 0.0, 31.0));
+		atomicOr(depthMask, 1u << slice);
+	}
+
 	// Calculate frustum planes
 	if (gl_LocalInvocationIndex == 0)
 	{
@@ -69,7 +86,7 @@ void main()
 		float depthMax = uintBitsToFloat(maxDepth);
 
 		// Calculate scale and bias
-		vec2 tileScale = screenSize / float(2 * WORKGROUP_SIZE);
+		vec2 tileScale = screenSize / float(2 * TILE_SIZE);
 		vec2 tileBias = tileScale - vec2(gl_WorkGroupID.xy);
 
 	    vec4 col1 = vec4(-projection[0][0] * tileScale.x, projection[0][1], tileBias.x, projection[0][3]);
@@ -92,13 +109,31 @@ void main()
 
 	barrier();
 
-	uint threadCount = WORKGROUP_SIZE * WORKGROUP_SIZE;
-	uint passCount = (lightCount + threadCount - 1) / threadCount;
+	// Only lights inside the view frustum, or with SUPER_TILES the
+	// ones in this tile's super-tile, can touch the tile
+	uint threadCount = TILE_SIZE * TILE_SIZE;
+	uint candidateCount = frustumLightBuffer.count;
+
+#ifdef SUPER_TILES
+	// Super-tiles with more lights than their list holds
+	// leave their tiles to test the whole frustum list
+	uint tilesPerSuperTile = uint(superTileSize) / TILE_SIZE;
+	uint superTile = (gl_WorkGroupID.y / tilesPerSuperTile) * uint(superTilesX) + gl_WorkGroupID.x / tilesPerSuperTile;
+	bool superTileList = superTileGridBuffer.counts[superTile] <= maxSuperTileLights;
+	if (superTileList) candidateCount = superTileGridBuffer.counts[superTile];
+#endif
+
+	uint passCount = (candidateCount + threadCount - 1) / threadCount;
 
 	for (uint i = 0; i < passCount; i++)
 	{
-		uint index = i * threadCount + gl_LocalInvocationIndex;
-		if (index > lightCount) break;
+		uint candidate = i * threadCount + gl_LocalInvocationIndex;
+		if (candidate >= candidateCount) break;
+
+		uint index = frustumLightBuffer.indices[candidate];
+#ifdef SUPER_TILES
+		if (superTileList) index = superTileLightBuffer.indices[superTile * maxSuperTileLights + candidate];
+#endif
 
 		vec4 position = view * vec4(lightBuffer.lights[index].positionRadius.xyz, 1.0);
 		float radius = lightBuffer.lights[index].positionRadius.w;
@@ -110,26 +145,97 @@ void main()
 			if (distance < 0.0) break;
 		}
 
+		if (distance >= 0.0 && depthMaskCulling)
+		{
+			// Slices covered by the light's depth extent
+			float lightDepth = -position.z;
+			uint first = uint(clamp((lightDepth - radius - tileMinDepth) * sliceScale, 0.0, 31.0));
+			uint last = uint(clamp((lightDepth + radius - tileMinDepth) * sliceScale, 0.0, 31.0));
+			uint lightMask = (0xFFFFFFFFu >> (31u - (last - first))) << first;
+
+			if ((lightMask & depthMask) == 0u) distance = -1.0;
+		}
+
 		if (distance >= 0.0)
 		{
+			// Keep counting past the end of the list, so the
+			// stats get the tile's real light count
 			uint visibleLightIndex = atomicAdd(nVisibleLights, 1);
-			if (visibleLightIndex >= 1024) break;
-			visibleLights[visibleLightIndex] = index;
+			if (visibleLightIndex < 1024) visibleLights[visibleLightIndex] = index;
 		}
 	}
 
 	barrier();
 
+#ifdef SHADE_TILES
 	if (gl_LocalInvocationIndex == 0)
 	{
-		for (uint i = 0; i < nVisibleLights; i++)
+		tileStatsBuffer.tiles[location] = nVisibleLights | (nVisibleLights > 1024? TILE_OVERFLOW: 0u);
+		atomicAdd(lightListCounterBuffer.entries, nVisibleLights);
+		if (nVisibleLights > 1024) atomicAdd(lightListCounterBuffer.dropped, nVisibleLights - 1024);
+	}
+
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+	if (any(greaterThanEqual(pixel, ivec2(screenSize)))) return;
+
+	float pixelDepth = texelFetch(depthMap, pixel, 0).r;
+	vec3 result = clearColor;
+
+	if (pixelDepth < 0.99999)
+	{
+		vec3 fragPos = reconstructPosition((vec2(pixel) + 0.5) / screenSize, pixelDepth);
+		vec3 normal = decodeNormal(texelFetch(gNormal, pixel, 0).rg);
+		vec4 albedoSpec = texelFetch(gAlbedoSpec, pixel, 0);
+
+		vec3 viewDir = normalize(cameraPosition - fragPos);
+
+		result = vec3(0.0);
+
+		uint tileLightCount = min(nVisibleLights, 1024);
+		for (uint i = 0; i < tileLightCount; i++)
 		{
-			visibleLightBuffer.indices[offset + i] = visibleLights[i];
+			result += calcLight(lightBuffer.lights[visibleLights[i]], albedoSpec.rgb, albedoSpec.a, normal, viewDir, fragPos);
 		}
+	}
 
-		if (nVisibleLights < 1024)
+	imageStore(shadedImage, pixel, vec4(result, 1.0));
+#else
+	// Find room for this tile's list
+	if (gl_LocalInvocationIndex == 0)
+	{
+		uint lightCount = nVisibleLights;
+		bool overflow = lightCount > 1024;
+		nVisibleLights = min(lightCount, 1024);
+		visibleLightOffset = location * reservedLights;
+
+		// The counter keeps going past the end of the pool, so the CPU
+		// can read back how much it needs. Until the pool grows, lists
+		// that don't fit are cut down to the tile's own region
+		if (nVisibleLights > reservedLights)
 		{
-			visibleLightBuffer.indices[offset + nVisibleLights] = -1;
+			uint poolOffset = atomicAdd(lightListCounterBuffer.count, nVisibleLights);
+			if (poolOffset < poolCapacity && nVisibleLights <= poolCapacity - poolOffset)
+			{
+				visibleLightOffset = gl_NumWorkGroups.x * gl_NumWorkGroups.y * reservedLights + poolOffset;
+			}
+			else
+			{
+				nVisibleLights = reservedLights;
+				overflow = true;
+			}
 		}
+
+		tileGridBuffer.tiles[location] = uvec2(visibleLightOffset, nVisibleLights);
+		tileStatsBuffer.tiles[location] = lightCount | (overflow? TILE_OVERFLOW: 0u);
+		atomicAdd(lightListCounterBuffer.entries, lightCount);
+		if (overflow) atomicAdd(lightListCounterBuffer.dropped, lightCount - nVisibleLights);
 	}
+
+	barrier();
+
+	for (uint i = gl_LocalInvocationIndex; i < nVisibleLights; i += threadCount)
+	{
+		visibleLightBuffer.indices[visibleLightOffset + i] = visibleLights[i];
+	}
+#endif
 }
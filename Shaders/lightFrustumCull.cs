@@ -0,0 +1,75 @@
+#version 430
+#include "frame.in"
+#include "light.in"
+#include "frustumLight.in"
+
+shared vec4 frustumPlanes[6];
+shared uint groupLights[256];
+shared uint nGroupLights;
+shared uint groupOffset;
+
+// Tests every light against the whole view frustum, and appends the
+// ones inside to frustumLightBuffer. Each workgroup gathers its lights
+// in shared memory first, so it needs only one global atomic
+layout (local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+void main()
+{
+	if (gl_LocalInvocationIndex == 0)
+	{
+		nGroupLights = 0;
+
+		// View space planes, from the rows of the projection matrix
+		vec4 row0 = vec4(projection[0][0], projection[1][0], projection[2][0], projection[3][0]);
+		vec4 row1 = vec4(projection[0][1], projection[1][1], projection[2][1], projection[3][1]);
+		vec4 row2 = vec4(projection[0][2], projection[1][2], projection[2][2], projection[3][2]);
+		vec4 row3 = vec4(projection[0][3], projection[1][3], projection[2][3], projection[3][3]);
+
+		frustumPlanes[0] = row3 + row0; // Left plane
+		frustumPlanes[1] = row3 - row0; // Right plane
+		frustumPlanes[2] = row3 - row1; // Top plane
+		frustumPlanes[3] = row3 + row1; // Bottom plane
+		frustumPlanes[4] = row3 + row2; // Near plane
+		frustumPlanes[5] = row3 - row2; // Far plane
+
+		for (int i = 0; i < 6; i++)
+		{
+			frustumPlanes[i] /= length(frustumPlanes[i].xyz);
+		}
+	}
+
+	barrier();
+
+	uint index = gl_GlobalInvocationID.x;
+	if (index < uint(lightCount))
+	{
+		vec4 position = view * vec4(lightBuffer.lights[index].positionRadius.xyz, 1.0);
+		float radius = lightBuffer.lights[index].positionRadius.w;
+
+		float distance = 0.0;
+		for (int j = 0; j < 6; j++)
+		{
+			distance = dot(position, frustumPlanes[j]) + radius;
+			if (distance < 0.0) break;
+		}
+
+		if (distance >= 0.0)
+		{
+			groupLights[atomicAdd(nGroupLights, 1)] = index;
+		}
+	}
+
+	barrier();
+
+	if (gl_LocalInvocationIndex == 0)
+	{
+		groupOffset = atomicAdd(frustumLightBuffer.count, nGroupLights);
+	}
+
+	barrier();
+
+	if (gl_LocalInvocationIndex < nGroupLights)
+	{
+		frustumLightBuffer.indices[groupOffset + gl_LocalInvocationIndex] = groupLights[gl_LocalInvocationIndex];
+	}
+}
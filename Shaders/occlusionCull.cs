@@ -0,0 +1,86 @@
+#version 430
+#include "mesh.in"
+
+// Tests the bounding box of every mesh left after frustum culling
+// against the Hi-Z pyramid of the previous frame, and clears the
+// instance count of the draw commands of hidden meshes
+layout (local_size_x = 64) in;
+
+struct DrawCommand
+{
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	int baseVertex;
+	uint baseInstance;
+};
+
+layout (std430, binding = 7) buffer DrawCommandBuffer
+{
+	DrawCommand commands[];
+} drawCommandBuffer;
+
+uniform uint commandCount;
+uniform mat4 previousViewProjection;
+uniform sampler2D hiZ;
+uniform int hiZLevels;
+
+bool isOccluded(MeshData mesh)
+{
+	// Screen rectangle and nearest depth of the box in the previous frame
+	vec3 rectMin = vec3(1.0e30);
+	vec3 rectMax = vec3(-1.0e30);
+
+	for (int i = 0; i < 8; i++)
+	{
+		vec3 corner = mix(mesh.boxMin.xyz, mesh.boxMax.xyz, vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+		vec4 clip = previousViewProjection * vec4(corner, 1.0);
+
+		// Boxes crossing the camera plane are always visible
+		if (clip.w <= 0.0) return false;
+
+		vec3 ndc = clip.xyz / clip.w * 0.5 + 0.5;
+		rectMin = min(rectMin, ndc);
+		rectMax = max(rectMax, ndc);
+	}
+
+	// Nothing is known about boxes that were off screen
+	if (rectMax.x < 0.0 || rectMax.y < 0.0 || rectMin.x > 1.0 || rectMin.y > 1.0) return false;
+
+	rectMin.xy = clamp(rectMin.xy, 0.0, 1.0);
+	rectMax.xy = clamp(rectMax.xy, 0.0, 1.0);
+
+	// Pick the level where the rectangle covers at most 2x2 texels
+	ivec2 baseSize = textureSize(hiZ, 0);
+	vec2 size = (rectMax.xy - rectMin.xy) * vec2(baseSize);
+	int level = clamp(int(ceil(log2(max(max(size.x, size.y), 1.0)))), 0, hiZLevels - 1);
+
+	// Map the rectangle's pixels down to the level. Odd sizes fold
+	// their leftover row and column into the last texel, so pixels
+	// past the level's end belong to it rather than scaling down
+	ivec2 levelSize = max(baseSize >> level, ivec2(1));
+	ivec2 pixelMin = min(ivec2(rectMin.xy * vec2(baseSize)), baseSize - 1);
+	ivec2 pixelMax = min(ivec2(rectMax.xy * vec2(baseSize)), baseSize - 1);
+	ivec2 first = min(pixelMin >> level, levelSize - 1);
+	ivec2 last = min(pixelMax >> level, levelSize - 1);
+
+	float depth = 0.0;
+	for (int y = first.y; y <= last.y; y++)
+	{
+		for (int x = first.x; x <= last.x; x++)
+		{
+			depth = max(depth, texelFetch(hiZ, ivec2(x, y), level).r);
+		}
+	}
+
+	return rectMin.z > depth;
+}
+
+void main()
+{
+	uint index = gl_GlobalInvocationID.x;
+	if (index >= commandCount) return;
+
+	MeshData mesh = meshBuffer.meshes[drawCommandBuffer.commands[index].baseInstance];
+	drawCommandBuffer.commands[index].instanceCount = isOccluded(mesh)? 0: 1;
+}
@@ -0,0 +1,25 @@
+#version 430
+#include "frame.in"
+#include "gbuffer.in"
+
+uniform sampler2D gNormal;
+uniform sampler2D depthMap;
+uniform bool showNormals;
+uniform float scale;
+
+in vec2 texCoord0;
+
+out vec4 color;
+
+// Renders scaled, absolute positions or normals decoded from the GBuffer
+void main()
+{
+	float depth = texture(depthMap, texCoord0).r;
+	if (depth >= 0.99999) discard;
+
+	vec3 value;
+	if (showNormals) value = decodeNormal(texture(gNormal, texCoord0).rg);
+	else value = reconstructPosition(texCoord0, depth);
+
+	color = vec4(abs(value) * scale, 1.0);
+}
@@ -1,30 +1,69 @@
 #version 430
+#include "frame.in"
 
-uniform int lightCount;
-uniform int tilesX;
+#include "tileStats.in"
 
-layout (std430, binding = 1) readonly buffer VisibleLightBuffer
-{
-	uint indices[];
-} visibleLightBuffer;
+#ifdef CLUSTERED
+#include "cluster.in"
+
+uniform sampler2D depthMap;
+#else
+#include "tile.in"
+#endif
+
+// Light counts from 0 to heatmapMax map to the color ramp, shown as
+// a legend inside legendRect (x, y, width, height in pixels)
+uniform float heatmapMax;
+uniform vec4 legendRect;
 
 in vec2 texCoord0;
 
 out vec4 color;
 
-void main()
+vec3 heatColor(float t)
 {
-	ivec2 tileIndex = ivec2(gl_FragCoord.xy / vec2(16.0, 16.0));
-	uint location = tileIndex.y * tilesX + tileIndex.x;
-	uint offset = location * 1024;
+	// Black, blue, cyan, green, yellow, red
+	const vec3 ramp[6] = vec3[](vec3(0.0, 0.0, 0.0), vec3(0.0, 0.0, 1.0), vec3(0.0, 1.0, 1.0),
+								vec3(0.0, 1.0, 0.0), vec3(1.0, 1.0, 0.0), vec3(1.0, 0.0, 0.0));
 
-	vec3 result = vec3(0.0);
+	t = clamp(t, 0.0, 1.0) * 5.0;
+	int i = min(int(t), 4);
+	return mix(ramp[i], ramp[i + 1], t - float(i));
+}
 
-	uint lastInd = offset + 1023;
-	for (uint i = offset; i <= lastInd && visibleLightBuffer.indices[i] != -1; i++)
+void main()
+{
+	// Color ramp, then a white swatch for overflowed tiles
+	vec2 legend = (gl_FragCoord.xy - legendRect.xy) / legendRect.zw;
+	if (legend.y >= 0.0 && legend.y < 1.0)
 	{
-		result += vec3(1.0) / float(lightCount);
+		if (legend.x >= 0.0 && legend.x < 1.0)
+		{
+			color = vec4(heatColor(legend.x), 1.0);
+			return;
+		}
+		if (legend.x >= 1.05 && legend.x < 1.1)
+		{
+			color = vec4(1.0);
+			return;
+		}
 	}
 
-	color = vec4(result, 1.0);
+#ifdef CLUSTERED
+	float depth = linearizeDepth(texture(depthMap, texCoord0).r);
+	uint cluster = getClusterIndex(gl_FragCoord.xy, depth);
+
+	uint count = clusterGridBuffer.clusters[cluster].y;
+
+	// Tiles whose lists were cut short
+	uvec2 tile = min(uvec2(gl_FragCoord.xy) / uint(clusterTileSize), uvec2(clusterCount.xy - 1));
+	bool overflow = (tileStatsBuffer.tiles[tile.y * clusterCount.x + tile.x] & TILE_OVERFLOW) != 0u;
+#else
+	uint entry = tileStatsBuffer.tiles[getTileIndex(gl_FragCoord.xy)];
+
+	uint count = entry & ~TILE_OVERFLOW;
+	bool overflow = (entry & TILE_OVERFLOW) != 0u;
+#endif
+
+	color = vec4(overflow? vec3(1.0): heatColor(float(count) / heatmapMax), 1.0);
 }
@@ -8,5 +8,5 @@ out vec4 color;
 
 void main()
 {
-	color = vec4(texture2D(screenTexture, texCoord0).rgb, 1.0);
+	color = vec4(texture(screenTexture, texCoord0).rgb, 1.0);
 }
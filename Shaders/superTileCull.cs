@@ -0,0 +1,113 @@
+#version 430
+#include "frame.in"
+#include "light.in"
+#include "frustumLight.in"
+#include "superTile.in"
+
+uniform sampler2D depthMap;
+
+shared uint minDepth;
+shared uint maxDepth;
+shared vec4 frustumPlanes[6];
+shared uint nSuperTileLights;
+
+// Coarse pass of the tile culling. One workgroup per super-tile finds
+// the lights in the view frustum that touch it, within its depth
+// bounds. The tiles inside it then only test those lights. Depth and
+// planes are built as in lightCull.cs, so every light a tile accepts
+// is in its super-tile's list
+layout (local_size_x = 16, local_size_y = 16, local_size_z = 1) in;
+
+void main()
+{
+	uint superTile = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+
+	if (gl_LocalInvocationIndex == 0)
+	{
+		minDepth = 0xFFFFFFFF;
+		maxDepth = 0;
+		nSuperTileLights = 0;
+	}
+
+	barrier();
+
+	// Calculate min and max depth over all the pixels of the super-tile
+	uint size = uint(superTileSize);
+	for (uint y = gl_LocalInvocationID.y; y < size; y += gl_WorkGroupSize.y)
+	{
+		for (uint x = gl_LocalInvocationID.x; x < size; x += gl_WorkGroupSize.x)
+		{
+			vec2 pixel = vec2(gl_WorkGroupID.xy * size + uvec2(x, y));
+			float depth = texture(depthMap, pixel / screenSize).r;
+			depth = (0.5 * projection[3][2]) / (depth + 0.5 * projection[2][2] - 0.5);
+
+			atomicMin(minDepth, floatBitsToUint(depth));
+			atomicMax(maxDepth, floatBitsToUint(depth));
+		}
+	}
+
+	barrier();
+
+	// Calculate frustum planes
+	if (gl_LocalInvocationIndex == 0)
+	{
+		float depthMin = uintBitsToFloat(minDepth);
+		float depthMax = uintBitsToFloat(maxDepth);
+
+		// Calculate scale and bias
+		vec2 tileScale = screenSize / float(2 * superTileSize);
+		vec2 tileBias = tileScale - vec2(gl_WorkGroupID.xy);
+
+		vec4 col1 = vec4(-projection[0][0] * tileScale.x, projection[0][1], tileBias.x, projection[0][3]);
+		vec4 col2 = vec4(projection[1][0], -projection[1][1] * tileScale.y, tileBias.y, projection[1][3]);
+		vec4 col4 = vec4(projection[3][0], projection[3][1],  -1.0f, projection[3][3]);
+
+		frustumPlanes[0] = col4 + col1; // Left plane
+		frustumPlanes[1] = col4 - col1; // Right plane
+		frustumPlanes[2] = col4 - col2; // Top plane
+		frustumPlanes[3] = col4 + col2; // Bottom plane
+		frustumPlanes[4] = vec4(0.0f, 0.0f, -1.0f, -depthMin); // Near plane
+		frustumPlanes[5] = vec4(0.0f, 0.0f, 1.0f, depthMax); // Far plane
+
+		// Normalize side planes
+		for(int i = 0; i < 4; i++)
+		{
+			frustumPlanes[i] /= length(frustumPlanes[i].xyz);
+		}
+	}
+
+	barrier();
+
+	uint threadCount = gl_WorkGroupSize.x * gl_WorkGroupSize.y;
+	uint frustumLightCount = frustumLightBuffer.count;
+	uint listOffset = superTile * maxSuperTileLights;
+
+	for (uint i = gl_LocalInvocationIndex; i < frustumLightCount; i += threadCount)
+	{
+		uint index = frustumLightBuffer.indices[i];
+		vec4 position = view * vec4(lightBuffer.lights[index].positionRadius.xyz, 1.0);
+		float radius = lightBuffer.lights[index].positionRadius.w;
+
+		float distance = 0.0;
+		for (int j = 0; j < 6; j++)
+		{
+			distance = dot(position, frustumPlanes[j]) + radius;
+			if (distance < 0.0) break;
+		}
+
+		if (distance >= 0.0)
+		{
+			uint superTileLightIndex = atomicAdd(nSuperTileLights, 1);
+			if (superTileLightIndex >= maxSuperTileLights) break;
+			superTileLightBuffer.indices[listOffset + superTileLightIndex] = index;
+		}
+	}
+
+	barrier();
+
+	// A count above maxSuperTileLights marks the list as incomplete
+	if (gl_LocalInvocationIndex == 0)
+	{
+		superTileGridBuffer.counts[superTile] = nSuperTileLights;
+	}
+}
@@ -0,0 +1,116 @@
+#include "benchmark.h"
+#include "sstream"
+
+#include <cmath>
+
+bool saveCameraPath(const string &filename, const CameraPath &path)
+{
+	std::ofstream file(filename.c_str());
+
+	if (!file.is_open())
+	{
+		cerr<<"Failed to write camera path '"<<filename<<"'."<<endl;
+		return false;
+	}
+
+	file.precision(9);
+	file<<"timestep "<<path.timestep<<"\n";
+
+	for (const CameraSample &s: path.samples)
+	{
+		file<<s.position.x<<" "<<s.position.y<<" "<<s.position.z<<" "<<s.pitch<<" "<<s.yaw<<"\n";
+	}
+
+	return true;
+}
+
+bool loadCameraPath(const string &filename, CameraPath &path)
+{
+	std::ifstream file(filename.c_str());
+
+	if (!file.is_open())
+	{
+		cerr<<"Failed to read camera path '"<<filename<<"'."<<endl;
+		return false;
+	}
+
+	string line;
+	path.samples.clear();
+
+	while (std::getline(file, line))
+	{
+		std::stringstream ss(line);
+
+		if (line.find("timestep") == 0)
+		{
+			string key;
+			ss>>key>>path.timestep;
+			continue;
+		}
+
+		CameraSample s;
+		if (ss>>s.position.x>>s.position.y>>s.position.z>>s.pitch>>s.yaw)
+		{
+			path.samples.push_back(s);
+		}
+	}
+
+	if (path.samples.empty() || path.timestep <= 0.0)
+	{
+		cerr<<"Camera path '"<<filename<<"' is empty or invalid."<<endl;
+		return false;
+	}
+
+	return true;
+}
+
+FrameStats computeFrameStats(vector<double> frameTimes)
+{
+	FrameStats stats;
+	if (frameTimes.empty()) return stats;
+
+	std::sort(frameTimes.begin(), frameTimes.end());
+
+	// Nearest-rank percentile
+	auto percentile = [&frameTimes](double p) {
+		int rank = int(std::ceil(p / 100.0 * frameTimes.size()));
+		return frameTimes[glm::clamp(rank - 1, 0, int(frameTimes.size()) - 1)];
+	};
+
+	double total = 0.0;
+	for (double t: frameTimes) total += t;
+
+	stats.frames = frameTimes.size();
+	stats.min = frameTimes.front();
+	stats.max = frameTimes.back();
+	stats.mean = total / frameTimes.size();
+	stats.p50 = percentile(50.0);
+	stats.p95 = percentile(95.0);
+	stats.p99 = percentile(99.0);
+
+	return stats;
+}
+
+bool writeBenchmarkReport(const string &filename, const vector<BenchmarkResult> &results)
+{
+	std::ofstream file(filename.c_str());
+
+	if (!file.is_open())
+	{
+		cerr<<"Failed to write benchmark report '"<<filename<<"'."<<endl;
+		return false;
+	}
+
+	// All times in milliseconds
+	file<<"model,technique,lights,occlusion,frames,min,mean,p50,p95,p99,max,triangles,fragments,dropped\n";
+
+	for (const BenchmarkResult &r: results)
+	{
+		file<<r.model<<","<<r.technique<<","<<r.lightCount<<","<<r.occlusionCulling<<","<<r.stats.frames<<","
+			<<r.stats.min * 1000.0<<","<<r.stats.mean * 1000.0<<","
+			<<r.stats.p50 * 1000.0<<","<<r.stats.p95 * 1000.0<<","<<r.stats.p99 * 1000.0<<","
+			<<r.stats.max * 1000.0<<","<<r.triangles<<","<<r.fragments<<","<<r.dropRate<<"\n";
+	}
+
+	return true;
+}
@@ -0,0 +1,51 @@
+#ifndef _BENCHMARK_H_INCLUDED_
+#define _BENCHMARK_H_INCLUDED_
+
+#include "main.h"
+
+struct CameraSample
+{
+	vec3 position;
+	float pitch;
+	float yaw;
+};
+
+struct CameraPath
+{
+	double timestep = 1.0 / 60.0;
+	vector<CameraSample> samples;
+};
+
+struct FrameStats
+{
+	int frames = 0;
+	double min = 0.0;
+	double mean = 0.0;
+	double max = 0.0;
+	double p50 = 0.0;
+	double p95 = 0.0;
+	double p99 = 0.0;
+};
+
+struct BenchmarkResult
+{
+	string model;
+	string technique;
+	int lightCount;
+	bool occlusionCulling;
+	FrameStats stats;
+
+	// Mean per frame, over every pass that draws the model
+	double triangles;
+	double fragments;
+
+	// Share of light list entries cut from full lists
+	double dropRate;
+};
+
+bool saveCameraPath(const string &filename, const CameraPath &path);
+bool loadCameraPath(const string &filename, CameraPath &path);
+FrameStats computeFrameStats(vector<double> frameTimes);
+bool writeBenchmarkReport(const string &filename, const vector<BenchmarkResult> &results);
+
+#endif // _BENCHMARK_H_INCLUDED_
@@ -0,0 +1,115 @@
+#include "culling.h"
+
+#if defined(__SSE__) || defined(_M_X64)
+#define USE_SSE
+#include <xmmintrin.h>
+#endif
+
+Frustum getFrustum(const mat4 &viewProjection)
+{
+	// Gribb/Hartmann, a point is inside if dot(plane, point) >= 0
+	// for all planes. glm matrices are column major, so rows are
+	// read across columns
+	vec4 rows[4];
+	for (int i = 0; i < 4; i++)
+	{
+		rows[i] = vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+	}
+
+	Frustum f;
+	f.planes[0] = rows[3] + rows[0]; // left
+	f.planes[1] = rows[3] - rows[0]; // right
+	f.planes[2] = rows[3] + rows[1]; // bottom
+	f.planes[3] = rows[3] - rows[1]; // top
+	f.planes[4] = rows[3] + rows[2]; // near
+	f.planes[5] = rows[3] - rows[2]; // far
+
+	return f;
+}
+
+void addBox(BoxList &boxes, const vec3 &min, const vec3 &max)
+{
+	vec3 center = (min + max) * 0.5f;
+	vec3 extent = (max - min) * 0.5f;
+
+	boxes.centerX.push_back(center.x);
+	boxes.centerY.push_back(center.y);
+	boxes.centerZ.push_back(center.z);
+	boxes.extentX.push_back(extent.x);
+	boxes.extentY.push_back(extent.y);
+	boxes.extentZ.push_back(extent.z);
+}
+
+int cullBoxes(const Frustum &frustum, const BoxList &boxes, vector<char> &visible)
+{
+	// A box is outside if it is completely behind any plane, ie if
+	// the distance of its center plus its projected extent is negative.
+	// Boxes crossing a corner of the frustum are kept
+	unsigned int count = boxes.centerX.size();
+	unsigned int i = 0;
+	int nVisible = 0;
+
+	visible.resize(count);
+
+#ifdef USE_SSE
+	__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+	__m128 absX[6], absY[6], absZ[6];
+	for (int j = 0; j < 6; j++)
+	{
+		const vec4 &p = frustum.planes[j];
+		planeX[j] = _mm_set1_ps(p.x);
+		planeY[j] = _mm_set1_ps(p.y);
+		planeZ[j] = _mm_set1_ps(p.z);
+		planeW[j] = _mm_set1_ps(p.w);
+		absX[j] = _mm_set1_ps(std::abs(p.x));
+		absY[j] = _mm_set1_ps(std::abs(p.y));
+		absZ[j] = _mm_set1_ps(std::abs(p.z));
+	}
+
+	const __m128 zero = _mm_setzero_ps();
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 cx = _mm_loadu_ps(&boxes.centerX[i]);
+		__m128 cy = _mm_loadu_ps(&boxes.centerY[i]);
+		__m128 cz = _mm_loadu_ps(&boxes.centerZ[i]);
+		__m128 ex = _mm_loadu_ps(&boxes.extentX[i]);
+		__m128 ey = _mm_loadu_ps(&boxes.extentY[i]);
+		__m128 ez = _mm_loadu_ps(&boxes.extentZ[i]);
+
+		__m128 outside = zero;
+		for (int j = 0; j < 6; j++)
+		{
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[j], cx), _mm_mul_ps(planeY[j], cy)),
+								  _mm_add_ps(_mm_mul_ps(planeZ[j], cz), planeW[j]));
+			__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absX[j], ex), _mm_mul_ps(absY[j], ey)),
+								  _mm_mul_ps(absZ[j], ez));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, r), zero));
+		}
+
+		int mask = _mm_movemask_ps(outside);
+		for (int k = 0; k < 4; k++)
+		{
+			visible[i + k] = !(mask & (1 << k));
+			nVisible += visible[i + k];
+		}
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		bool outside = false;
+		for (int j = 0; j < 6 && !outside; j++)
+		{
+			const vec4 &p = frustum.planes[j];
+			float d = p.x * boxes.centerX[i] + p.y * boxes.centerY[i] + p.z * boxes.centerZ[i] + p.w;
+			float r = std::abs(p.x) * boxes.extentX[i] + std::abs(p.y) * boxes.extentY[i] + std::abs(p.z) * boxes.extentZ[i];
+			outside = d + r < 0.0f;
+		}
+
+		visible[i] = !outside;
+		nVisible += visible[i];
+	}
+
+	return nVisible;
+}
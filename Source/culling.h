@@ -0,0 +1,28 @@
+#ifndef _CULLING_H_INCLUDED_
+#define _CULLING_H_INCLUDED_
+
+#include "main.h"
+
+// Planes of a view frustum, pointing inwards
+struct Frustum
+{
+	vec4 planes[6];
+};
+
+// Axis aligned boxes stored as separate arrays so they
+// can be tested four at a time
+struct BoxList
+{
+	vector<float> centerX;
+	vector<float> centerY;
+	vector<float> centerZ;
+	vector<float> extentX;
+	vector<float> extentY;
+	vector<float> extentZ;
+};
+
+Frustum getFrustum(const mat4 &viewProjection);
+void addBox(BoxList &boxes, const vec3 &min, const vec3 &max);
+int cullBoxes(const Frustum &frustum, const BoxList &boxes, vector<char> &visible);
+
+#endif // _CULLING_H_INCLUDED_
@@ -0,0 +1,85 @@
+#include "headless.h"
+
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstring>
+
+EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+EGLContext eglContext = EGL_NO_CONTEXT;
+
+bool createHeadlessContext(int majorVersion, int minorVersion)
+{
+	// Prefer the surfaceless platform, which needs neither a GPU nor
+	// a display server (eg. Mesa llvmpipe on a build machine)
+	const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	if (clientExtensions && strstr(clientExtensions, "EGL_MESA_platform_surfaceless"))
+	{
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay)
+		{
+			eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		}
+	}
+
+	if (eglDisplay == EGL_NO_DISPLAY)
+	{
+		eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+
+	EGLint major, minor;
+	if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, &major, &minor))
+	{
+		cerr<<"EGL: Failed to initialize display"<<endl;
+		return false;
+	}
+
+	const char *extensions = eglQueryString(eglDisplay, EGL_EXTENSIONS);
+	if (!extensions || !strstr(extensions, "EGL_KHR_surfaceless_context") || !strstr(extensions, "EGL_KHR_no_config_context"))
+	{
+		cerr<<"EGL: Surfaceless contexts are not supported"<<endl;
+		eglTerminate(eglDisplay);
+		return false;
+	}
+
+	eglBindAPI(EGL_OPENGL_API);
+
+	EGLint attributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, majorVersion,
+		EGL_CONTEXT_MINOR_VERSION, minorVersion,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+		EGL_NONE
+	};
+
+	eglContext = eglCreateContext(eglDisplay, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+	if (eglContext == EGL_NO_CONTEXT || !eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext))
+	{
+		cerr<<"EGL: Failed to create OpenGL "<<majorVersion<<"."<<minorVersion<<" context"<<endl;
+		eglTerminate(eglDisplay);
+		return false;
+	}
+
+	return true;
+}
+
+void destroyHeadlessContext()
+{
+	eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(eglDisplay, eglContext);
+	eglTerminate(eglDisplay);
+}
+
+#else
+
+bool createHeadlessContext(int majorVersion, int minorVersion)
+{
+	cerr<<"Headless mode is not available, EGL was not found at build time"<<endl;
+	return false;
+}
+
+void destroyHeadlessContext()
+{
+}
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef _HEADLESS_H_INCLUDED_
+#define _HEADLESS_H_INCLUDED_
+
+#include "main.h"
+
+bool createHeadlessContext(int majorVersion, int minorVersion);
+void destroyHeadlessContext();
+
+#endif // _HEADLESS_H_INCLUDED_
@@ -0,0 +1,308 @@
+#include "lights.h"
+#include "threadpool.h"
+
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64)
+#define USE_SSE
+#include <xmmintrin.h>
+#endif
+
+// The AVX kernel is compiled for AVX on its own and only used when
+// the CPU has it, so the rest of the program runs anywhere
+#if defined(USE_SSE) && defined(__GNUC__)
+#define USE_AVX
+#include <immintrin.h>
+#endif
+
+// Lights per parallelFor item. A multiple of every SIMD width, so
+// which lights take the scalar path only depends on the light count
+const int LIGHT_BLOCK_SIZE = 4096;
+
+// Components of the random numbers drawn for each retarget count
+enum LightRandom
+{
+	RANDOM_TARGET_X = 0,
+	RANDOM_TARGET_Y,
+	RANDOM_TARGET_Z,
+	RANDOM_POSITION_X,
+	RANDOM_POSITION_Y,
+	RANDOM_POSITION_Z,
+	RANDOM_RADIUS,
+	RANDOM_COLOR_R,
+	RANDOM_COLOR_G,
+	RANDOM_COLOR_B,
+	RANDOM_SPECULAR
+};
+
+struct MoveParams
+{
+	float deltaTime;
+	uint32_t seed;
+	vec3 boxMin;
+	vec3 boxSize;
+};
+
+uint32_t pcgHash(uint32_t x)
+{
+	uint32_t state = x * 747796405u + 2891336453u;
+	uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+float lightRandom(uint32_t seed, uint32_t index, uint32_t counter, uint32_t component)
+{
+	uint32_t key = pcgHash(index ^ pcgHash(seed));
+	key = pcgHash(key + counter);
+
+	// 24 bits, so the result is exact and below 1
+	return (pcgHash(key + component) >> 8) * (1.0f / 16777216.0f);
+}
+
+void retarget(LightStore &store, int i, const MoveParams &params)
+{
+	uint32_t counter = ++store.retargets[i];
+	store.targetX[i] = params.boxMin.x + params.boxSize.x * lightRandom(params.seed, i, counter, RANDOM_TARGET_X);
+	store.targetY[i] = params.boxMin.y + params.boxSize.y * lightRandom(params.seed, i, counter, RANDOM_TARGET_Y);
+	store.targetZ[i] = params.boxMin.z + params.boxSize.z * lightRandom(params.seed, i, counter, RANDOM_TARGET_Z);
+}
+
+// All kernels do the same operations in the same order, and sqrt and
+// division are exact, so they give the same results
+void moveLightsScalar(LightStore &store, int begin, int end, const MoveParams &params)
+{
+	for (int i = begin; i < end; i++)
+	{
+		float dx = store.targetX[i] - store.positionX[i];
+		float dy = store.targetY[i] - store.positionY[i];
+		float dz = store.targetZ[i] - store.positionZ[i];
+		float length = std::sqrt(dx * dx + dy * dy + dz * dz);
+		float step = params.deltaTime * store.speed[i] / length;
+
+		float x = store.positionX[i] + dx * step;
+		float y = store.positionY[i] + dy * step;
+		float z = store.positionZ[i] + dz * step;
+		store.positionX[i] = x;
+		store.positionY[i] = y;
+		store.positionZ[i] = z;
+
+		dx = store.targetX[i] - x;
+		dy = store.targetY[i] - y;
+		dz = store.targetZ[i] - z;
+		if (dx * dx + dy * dy + dz * dz < 0.1f) retarget(store, i, params);
+	}
+}
+
+#ifdef USE_SSE
+void moveLightsSSE(LightStore &store, int begin, int end, const MoveParams &params)
+{
+	const __m128 deltaTime = _mm_set1_ps(params.deltaTime);
+	const __m128 threshold = _mm_set1_ps(0.1f);
+
+	int i = begin;
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128 px = _mm_loadu_ps(&store.positionX[i]);
+		__m128 py = _mm_loadu_ps(&store.positionY[i]);
+		__m128 pz = _mm_loadu_ps(&store.positionZ[i]);
+		__m128 tx = _mm_loadu_ps(&store.targetX[i]);
+		__m128 ty = _mm_loadu_ps(&store.targetY[i]);
+		__m128 tz = _mm_loadu_ps(&store.targetZ[i]);
+
+		__m128 dx = _mm_sub_ps(tx, px);
+		__m128 dy = _mm_sub_ps(ty, py);
+		__m128 dz = _mm_sub_ps(tz, pz);
+		__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+		__m128 step = _mm_div_ps(_mm_mul_ps(deltaTime, _mm_loadu_ps(&store.speed[i])), length);
+
+		px = _mm_add_ps(px, _mm_mul_ps(dx, step));
+		py = _mm_add_ps(py, _mm_mul_ps(dy, step));
+		pz = _mm_add_ps(pz, _mm_mul_ps(dz, step));
+		_mm_storeu_ps(&store.positionX[i], px);
+		_mm_storeu_ps(&store.positionY[i], py);
+		_mm_storeu_ps(&store.positionZ[i], pz);
+
+		dx = _mm_sub_ps(tx, px);
+		dy = _mm_sub_ps(ty, py);
+		dz = _mm_sub_ps(tz, pz);
+		__m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+		// Arrivals are rare, so new targets are picked one by one
+		int mask = _mm_movemask_ps(_mm_cmplt_ps(distance2, threshold));
+		for (int k = 0; mask != 0; k++, mask >>= 1)
+		{
+			if (mask & 1) retarget(store, i + k, params);
+		}
+	}
+
+	moveLightsScalar(store, i, end, params);
+}
+#endif
+
+#ifdef USE_AVX
+__attribute__((target("avx")))
+void moveLightsAVX(LightStore &store, int begin, int end, const MoveParams &params)
+{
+	const __m256 deltaTime = _mm256_set1_ps(params.deltaTime);
+	const __m256 threshold = _mm256_set1_ps(0.1f);
+
+	int i = begin;
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256 px = _mm256_loadu_ps(&store.positionX[i]);
+		__m256 py = _mm256_loadu_ps(&store.positionY[i]);
+		__m256 pz = _mm256_loadu_ps(&store.positionZ[i]);
+		__m256 tx = _mm256_loadu_ps(&store.targetX[i]);
+		__m256 ty = _mm256_loadu_ps(&store.targetY[i]);
+		__m256 tz = _mm256_loadu_ps(&store.targetZ[i]);
+
+		__m256 dx = _mm256_sub_ps(tx, px);
+		__m256 dy = _mm256_sub_ps(ty, py);
+		__m256 dz = _mm256_sub_ps(tz, pz);
+		__m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz)));
+		__m256 step = _mm256_div_ps(_mm256_mul_ps(deltaTime, _mm256_loadu_ps(&store.speed[i])), length);
+
+		px = _mm256_add_ps(px, _mm256_mul_ps(dx, step));
+		py = _mm256_add_ps(py, _mm256_mul_ps(dy, step));
+		pz = _mm256_add_ps(pz, _mm256_mul_ps(dz, step));
+		_mm256_storeu_ps(&store.positionX[i], px);
+		_mm256_storeu_ps(&store.positionY[i], py);
+		_mm256_storeu_ps(&store.positionZ[i], pz);
+
+		dx = _mm256_sub_ps(tx, px);
+		dy = _mm256_sub_ps(ty, py);
+		dz = _mm256_sub_ps(tz, pz);
+		__m256 distance2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+
+		int mask = _mm256_movemask_ps(_mm256_cmp_ps(distance2, threshold, _CMP_LT_OQ));
+		for (int k = 0; mask != 0; k++, mask >>= 1)
+		{
+			if (mask & 1) retarget(store, i + k, params);
+		}
+	}
+
+	moveLightsScalar(store, i, end, params);
+}
+#endif
+
+typedef void (*MoveKernel)(LightStore &store, int begin, int end, const MoveParams &params);
+
+MoveKernel moveKernel = nullptr;
+const char *moveKernelName = "";
+
+void selectMoveKernel()
+{
+	if (moveKernel) return;
+
+	moveKernel = moveLightsScalar;
+	moveKernelName = "scalar";
+
+#ifdef USE_SSE
+	moveKernel = moveLightsSSE;
+	moveKernelName = "SSE";
+#endif
+
+#ifdef USE_AVX
+	if (__builtin_cpu_supports("avx"))
+	{
+		moveKernel = moveLightsAVX;
+		moveKernelName = "AVX";
+	}
+#endif
+}
+
+void resizeLights(LightStore &store, int count)
+{
+	vector<float> *arrays[] = {
+		&store.positionX, &store.positionY, &store.positionZ, &store.radius,
+		&store.colorR, &store.colorG, &store.colorB, &store.specular,
+		&store.targetX, &store.targetY, &store.targetZ, &store.speed
+	};
+
+	for (vector<float> *array: arrays)
+	{
+		array->resize(count);
+	}
+	store.retargets.resize(count);
+}
+
+void generateLights(LightStore &store, int first, int count, uint32_t seed, const vec3 &boxMin, const vec3 &boxMax)
+{
+	resizeLights(store, count);
+
+	vec3 boxSize = boxMax - boxMin;
+	float maxDim = glm::max(glm::max(boxSize.x, boxSize.y), boxSize.z);
+
+	parallelFor((count - first + LIGHT_BLOCK_SIZE - 1) / LIGHT_BLOCK_SIZE, [&](int beginBlock, int endBlock)
+	{
+		int end = glm::min(first + endBlock * LIGHT_BLOCK_SIZE, count);
+		for (int i = first + beginBlock * LIGHT_BLOCK_SIZE; i < end; i++)
+		{
+			store.positionX[i] = boxMin.x + boxSize.x * lightRandom(seed, i, 0, RANDOM_POSITION_X);
+			store.positionY[i] = boxMin.y + boxSize.y * lightRandom(seed, i, 0, RANDOM_POSITION_Y);
+			store.positionZ[i] = boxMin.z + boxSize.z * lightRandom(seed, i, 0, RANDOM_POSITION_Z);
+			store.radius[i] = maxDim / 50.0f + (maxDim / 5.0f - maxDim / 50.0f) * lightRandom(seed, i, 0, RANDOM_RADIUS);
+
+			store.colorR[i] = lightRandom(seed, i, 0, RANDOM_COLOR_R);
+			store.colorG[i] = lightRandom(seed, i, 0, RANDOM_COLOR_G);
+			store.colorB[i] = lightRandom(seed, i, 0, RANDOM_COLOR_B);
+			store.specular[i] = lightRandom(seed, i, 0, RANDOM_SPECULAR);
+
+			store.targetX[i] = boxMin.x + boxSize.x * lightRandom(seed, i, 0, RANDOM_TARGET_X);
+			store.targetY[i] = boxMin.y + boxSize.y * lightRandom(seed, i, 0, RANDOM_TARGET_Y);
+			store.targetZ[i] = boxMin.z + boxSize.z * lightRandom(seed, i, 0, RANDOM_TARGET_Z);
+
+			// Lights move at different speeds so they don't look synchronized
+			store.speed[i] = float(i % 1024) / 100.0f;
+			store.retargets[i] = 0;
+		}
+	});
+}
+
+void animateLights(LightStore &store, int count, float deltaTime, uint32_t seed, const vec3 &boxMin, const vec3 &boxMax)
+{
+	selectMoveKernel();
+
+	MoveParams params = {deltaTime, seed, boxMin, boxMax - boxMin};
+
+	parallelFor((count + LIGHT_BLOCK_SIZE - 1) / LIGHT_BLOCK_SIZE, [&](int beginBlock, int endBlock)
+	{
+		moveKernel(store, beginBlock * LIGHT_BLOCK_SIZE, glm::min(endBlock * LIGHT_BLOCK_SIZE, count), params);
+	});
+}
+
+void packLights(const LightStore &store, int first, int count, Light *lights)
+{
+	parallelFor((count + LIGHT_BLOCK_SIZE - 1) / LIGHT_BLOCK_SIZE, [&](int beginBlock, int endBlock)
+	{
+		int end = first + glm::min(endBlock * LIGHT_BLOCK_SIZE, count);
+		for (int i = first + beginBlock * LIGHT_BLOCK_SIZE; i < end; i++)
+		{
+			Light &light = lights[i - first];
+			light.positionRadius = vec4(store.positionX[i], store.positionY[i], store.positionZ[i], store.radius[i]);
+			light.colorSpec = vec4(store.colorR[i], store.colorG[i], store.colorB[i], store.specular[i]);
+		}
+	});
+}
+
+void unpackLights(LightStore &store, int first, int count, const Light *lights)
+{
+	for (int i = first; i < first + count; i++)
+	{
+		const Light &light = lights[i - first];
+		store.positionX[i] = light.positionRadius.x;
+		store.positionY[i] = light.positionRadius.y;
+		store.positionZ[i] = light.positionRadius.z;
+		store.radius[i] = light.positionRadius.w;
+		store.colorR[i] = light.colorSpec.x;
+		store.colorG[i] = light.colorSpec.y;
+		store.colorB[i] = light.colorSpec.z;
+		store.specular[i] = light.colorSpec.w;
+	}
+}
+
+const char *getLightKernelName()
+{
+	selectMoveKernel();
+	return moveKernelName;
+}
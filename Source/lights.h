@@ -0,0 +1,57 @@
+#ifndef _LIGHTS_H_INCLUDED_
+#define _LIGHTS_H_INCLUDED_
+
+#include "main.h"
+#include <cstdint>
+
+// Layout of a light on the GPU, see Shaders/light.in
+struct Light
+{
+	vec4 positionRadius;
+	vec4 colorSpec;
+};
+
+// Lights stored as separate arrays so they can be moved several at
+// a time. All random numbers of a light come from lightRandom, keyed
+// on its index and retarget count, so the result of generating and
+// moving lights on the CPU doesn't depend on the thread count or SIMD
+// width. Shaders/lightAnimation.cs isn't bit exact with the CPU, so
+// lights moved on the GPU can drift from these
+struct LightStore
+{
+	vector<float> positionX;
+	vector<float> positionY;
+	vector<float> positionZ;
+	vector<float> radius;
+	vector<float> colorR;
+	vector<float> colorG;
+	vector<float> colorB;
+	vector<float> specular;
+	vector<float> targetX;
+	vector<float> targetY;
+	vector<float> targetZ;
+	vector<float> speed;
+	vector<uint32_t> retargets;
+};
+
+// Counter based random number in [0, 1). Shaders/lightAnimation.cs
+// implements the same function
+float lightRandom(uint32_t seed, uint32_t index, uint32_t counter, uint32_t component);
+
+// Resizes the store to count lights, and generates the ones from first
+// on. Each light only depends on its index, so growing the store gives
+// the same lights as generating them all at once
+void generateLights(LightStore &store, int first, int count, uint32_t seed, const vec3 &boxMin, const vec3 &boxMax);
+
+// Moves the first count lights towards their targets, and picks new
+// targets inside the box for the ones that got there
+void animateLights(LightStore &store, int count, float deltaTime, uint32_t seed, const vec3 &boxMin, const vec3 &boxMax);
+
+// Conversion to and from the GPU layout
+void packLights(const LightStore &store, int first, int count, Light *lights);
+void unpackLights(LightStore &store, int first, int count, const Light *lights);
+
+// Name of the SIMD instruction set animateLights uses
+const char *getLightKernelName();
+
+#endif // _LIGHTS_H_INCLUDED_
@@ -4,6 +4,12 @@
 #include "shader.h"
 #include "model.h"
 #include "text.h"
+#include "headless.h"
+#include "benchmark.h"
+#include "profiler.h"
+#include "threadpool.h"
+#include "lights.h"
+#include "tilestats.h"
 
 // Constants
 const char *title = "Render Demo";
@@ -11,16 +17,72 @@ const int width = 1920;
 const int height = 1080;
 const bool fullScreen = true;
 
-const int MAX_LIGHT_COUNT = 4096;
-const int GROUP_X = 16;
-const int GROUP_Y = 16;
+// Light buffers start at INITIAL_LIGHT_CAPACITY lights, and double
+// in size when more are needed
+const int MAX_LIGHT_COUNT = 1 << 20;
+const int INITIAL_LIGHT_CAPACITY = 4096;
+const int LIGHT_BUFFER_FRAMES = 3;
+const GLuint64 LIGHT_FENCE_TIMEOUT = 100000000; // ns
+
+// Tile sizes the tiled techniques can cull lights with. Each is
+// compiled into its own variant of the tile shaders
+static const int TileSizes[] = {8, 16, 32};
+const int TILE_SIZE_COUNT = sizeof(TileSizes) / sizeof(TileSizes[0]);
+const int DEFAULT_TILE_SIZE = 16;
+
+// Auto-tuning times TILE_TUNE_FRAMES frames with each tile size and
+// keeps the fastest. The first TILE_TUNE_SKIP_FRAMES after each switch
+// compile shaders and resize buffers, so they aren't counted
+const int TILE_TUNE_SKIP_FRAMES = 2;
+const int TILE_TUNE_FRAMES = 16;
+
+// Most lights lightCull.cs keeps per tile. Each tile has room for
+// TILE_RESERVED_LIGHTS of its own, longer lists come from a shared
+// pool. The pool starts with room for INITIAL_TILE_POOL_LIGHTS and
+// grows to what the tiles ask for, see growListPools
+const int MAX_TILE_LIGHTS = 1024;
+const int TILE_RESERVED_LIGHTS = 16;
+const int INITIAL_TILE_POOL_LIGHTS = 1 << 18;
+
+// Light count shown as red in the heatmap, and the size of its legend.
+// The right margin leaves room for the overflow swatch and its label
+const int HEATMAP_MAX_LIGHTS = 256;
+const int HEATMAP_LEGEND_WIDTH = 400;
+const int HEATMAP_LEGEND_HEIGHT = 20;
+const int HEATMAP_LEGEND_RIGHT = 120;
+const int HEATMAP_LEGEND_BOTTOM = 40;
+
+// Tiles are grouped into super-tiles, which are culled first. Their
+// lists hold as many lights as the light buffers, up to a limit
+const int SUPER_TILE_SIZE = 64;
+const int MAX_SUPER_TILE_LIGHTS = 16384;
 
 const float CAMERA_Z_NEAR = 0.01;
 const float CAMERA_Z_FAR = 50.0;
 
+// Clusters are CLUSTER_TILE_SIZE pixel tiles on screen, split into
+// CLUSTER_SLICES exponentially spaced slices in depth. Each tile has
+// room for CLUSTER_RESERVED_LIGHTS list entries of its own, longer
+// lists come from a shared pool as for the tiles. It grows up to
+// MAX_CLUSTER_POOL_LIGHTS, past which lists are cut short
+const int CLUSTER_TILE_SIZE = 64;
+const int CLUSTER_SLICES = 32;
+const float CLUSTER_Z_NEAR = 0.5;
+const int CLUSTER_RESERVED_LIGHTS = 1024;
+const int INITIAL_CLUSTER_POOL_LIGHTS = 1 << 20;
+const int MAX_CLUSTER_POOL_LIGHTS = 1 << 25;
+
 const vec3 CLEAR_COLOR = vec3(0.11, 0.36, 0.67);
+const float LIGHT_SPHERE_SCALE = 0.05; // of the light radius
 const int LIGHT_SEED = 1;
 
+// Normals, albedo + specular and depth, for either GBuffer format
+const int GBUFFER_BYTES_PER_PIXEL = 4 + 4 + 4;
+
+const double HEADLESS_TIMESTEP = 1.0 / 60.0;
+const int HEADLESS_DEFAULT_FRAMES = 600;
+const int BENCHMARK_WARMUP_FRAMES = 10;
+
 // Lists
 enum OutputMode
 {
@@ -45,6 +107,9 @@ enum Technique
 	TECHNIQUE_FORWARD_PLUS,
 	TECHNIQUE_DEFERRED,
 	TECHNIQUE_FORWARD,
+	TECHNIQUE_CLUSTERED,
+	TECHNIQUE_CLUSTERED_FORWARD,
+	TECHNIQUE_DEFERRED_COMPUTE,
 
 	TECHNIQUE_MAX
 };
@@ -53,7 +118,24 @@ static const char *TechniqueStr[] = {
 	"Tiled Deferred",
 	"Forward+",
 	"Deferred",
-	"Forward"
+	"Forward",
+	"Clustered Deferred",
+	"Clustered Forward",
+	"Compute Tiled Deferred"
+};
+
+// Storage of the octahedral encoded GBuffer normals
+enum GBufferFormat
+{
+	GBUFFER_RG16 = 0,
+	GBUFFER_RGB10A2,
+
+	GBUFFER_FORMAT_MAX
+};
+
+static const char *GBufferFormatStr[] = {
+	"RG16",
+	"RGB10A2"
 };
 
 static const char *ModelStr[] = {
@@ -62,10 +144,25 @@ static const char *ModelStr[] = {
 };
 
 // Types
-struct Light
+// Light target and retarget count used by Shaders/lightAnimation.cs
+struct LightState
 {
-	vec4 positionRadius;
-	vec4 colorSpec;
+	vec3 target;
+	GLuint retargets;
+};
+
+// std140 layout of the FrameData block in Shaders/frame.in
+struct FrameData
+{
+	mat4 viewProjection;
+	mat4 inverseViewProjection;
+	mat4 view;
+	mat4 projection;
+	vec3 cameraPosition;
+	float zNear;
+	vec2 screenSize;
+	float zFar;
+	GLint lightCount;
 };
 
 // Variables
@@ -77,117 +174,631 @@ bool showHelp = false;
 bool showHUD = true;
 bool moveLights = true;
 bool lightSpheres = false;
+bool occlusionCulling = true;
+bool gpuLightAnimation = false;
+bool superTileCulling = true;
+bool depthMaskCulling[TECHNIQUE_MAX] = {};
+TextureFilter textureFilter = FILTER_ANISOTROPIC;
+GBufferFormat gBufferFormat = GBUFFER_RG16;
+
+bool headless = false;
+int headlessFrames = 0;
+double headlessSeconds = 0.0;
+
+string recordFile = "camera.path";
+string replayFile;
+string reportFile = "benchmark.csv";
+string gpuLogFile;
+string tileStatsLogFile;
 
 // Internal variables
 SDL_Window *window = nullptr;
 SDL_GLContext glContext;
 
+// Stands in for the default framebuffer in headless mode
+GLuint screenFBO = 0;
+GLuint screenColorRBO = 0;
+GLuint screenDepthRBO = 0;
+
 double curTime = 0.0;
 double deltaTime = 0.0;
 bool quitting = false;
 bool mouseDown = false;
 float framerate = 0.0;
 
+bool recording = false;
+double recordTime = 0.0;
+CameraPath recordedPath;
+
 Camera camera;
 
 Shader colorShader;
 Shader depthShader;
 Shader lightCullShader;
+Shader lightCullSuperTileShader;
+Shader superTileCullShader;
+Shader shadeTilesShader;
+Shader shadeSuperTilesShader;
 Shader forwardShader;
 Shader forwardPlusShader;
 Shader deferredGBufferShader;
 Shader deferredShader;
 Shader deferredTiledShader;
+Shader clusterCullShader;
+Shader forwardClusteredShader;
+Shader deferredClusteredShader;
 Shader screenTextureShader;
 Shader screenDepthShader;
 Shader screenLightHeatmapShader;
-Shader screenAbsTextureShader;
+Shader screenClusterHeatmapShader;
+Shader screenGBufferShader;
+Shader hiZCopyShader;
+Shader hiZDownsampleShader;
+Shader occlusionCullShader;
+Shader lightAnimationShader;
+Shader lightFrustumCullShader;
 
 vector<Model> models;
 Mesh screenQuad;
 Model model;
 Model sphere;
 
+GLuint frameDataBuffer = 0;
 GLuint lightBuffer = 0;
 GLuint visibleLightBuffer = 0;
 
+// Number of lights the store and light buffers hold
+int lightCapacity = 0;
+
+// lightBuffer holds one segment per frame in flight. Each upload goes
+// to the next segment, once the fence of the last frame reading it
+// has passed. lightRing maps the whole buffer when persistent mapping
+// is supported
+Light *lightRing = nullptr;
+GLsync lightFences[LIGHT_BUFFER_FRAMES] = {0};
+GLsizeiptr lightSegmentSize = 0;
+int lightSegment = 0;
+int uploadedLightCount = -1;
+
+// Lights animated on the GPU, with their targets and random states.
+// lightsOnGPU is set while these hold the current lights
+GLuint gpuLightBuffer = 0;
+GLuint lightStateBuffer = 0;
+bool lightsOnGPU = false;
+GLuint tileGridBuffer = 0;
+GLuint lightListCounterBuffer = 0;
+
+// Count and indices of the lights inside the view frustum
+GLuint frustumLightBuffer = 0;
+
+int tileSize = DEFAULT_TILE_SIZE;
+int tilesX = 0;
+int tilesY = 0;
+int tilePoolCapacity = INITIAL_TILE_POOL_LIGHTS;
+
+// Index of the tile size being timed, or -1 when not auto-tuning
+bool autoTuneTiles = false;
+int tileTuneStep = -1;
+int tileTuneFirstFrame = 0;
+int tileTuneLastFrame = -1;
+int tileTuneSamples = 0;
+double tileTuneTimes[TILE_SIZE_COUNT] = {};
+
+// Light list of each super-tile, at a fixed offset
+int superTilesX = (width + SUPER_TILE_SIZE - 1) / SUPER_TILE_SIZE;
+int superTilesY = (height + SUPER_TILE_SIZE - 1) / SUPER_TILE_SIZE;
+int superTileLights = 0;
+GLuint superTileGridBuffer = 0;
+GLuint superTileLightBuffer = 0;
+
+int clustersX = (width + CLUSTER_TILE_SIZE - 1) / CLUSTER_TILE_SIZE;
+int clustersY = (height + CLUSTER_TILE_SIZE - 1) / CLUSTER_TILE_SIZE;
+int clusterPoolCapacity = INITIAL_CLUSTER_POOL_LIGHTS;
+
+GLuint clusterGridBuffer = 0;
+GLuint clusterLightBuffer = 0;
+
 GLuint depthFBO;
 GLuint depthTexture;
 
+// Farthest depth pyramid of the last frame, used for occlusion culling
+GLuint hiZTexture;
+int hiZLevels = 1;
+bool hiZValid = false;
+int hiZModel = -1;
+mat4 hiZViewProjection;
+
 GLuint gFBO;
 GLuint gRBO;
-GLuint gPositionTex;
 GLuint gNormalTex;
 GLuint gColSpecTex;
 
-Light lights[MAX_LIGHT_COUNT];
-vec3 lightTargets[MAX_LIGHT_COUNT];
+// Output of Compute Tiled Deferred, blitted to screen
+GLuint shadedFBO;
+GLuint shadedTexture;
 
-float getRand(float min, float max)
+LightStore lightStore;
+double lightUpdateTime = 0.0;
+
+void uploadLights()
 {
-	float range = max-min;
-	return (rand()/(float)INT_MAX * range + min);
+	lightSegment = (lightSegment + 1) % LIGHT_BUFFER_FRAMES;
+
+	GLsync &fence = lightFences[lightSegment];
+	if (fence)
+	{
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, LIGHT_FENCE_TIMEOUT) == GL_TIMEOUT_EXPIRED);
+		glDeleteSync(fence);
+		fence = 0;
+	}
+
+	// Only the active lights are written
+	GLintptr offset = lightSegment * lightSegmentSize;
+	if (lightRing)
+	{
+		packLights(lightStore, 0, lightCount, (Light*)((char*)lightRing + offset));
+	}
+	else if (lightCount > 0)
+	{
+		vector<Light> lights(lightCount);
+		packLights(lightStore, 0, lightCount, &lights[0]);
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, lightCount * sizeof(Light), &lights[0]);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, lightBuffer, offset, lightSegmentSize);
+	uploadedLightCount = lightCount;
 }
 
-void updateLights()
+void fenceLights()
+{
+	// Marks the end of the last frame reading the current segment
+	GLsync &fence = lightFences[lightSegment];
+	if (fence) glDeleteSync(fence);
+	fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void resizeTileBuffers()
+{
+	// Each tile's own region, then the shared pool. Neither
+	// depends on the light count
+	GLsizeiptr reserved = tilesX * tilesY * TILE_RESERVED_LIGHTS;
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, tileGridBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, tilesX * tilesY * 2 * sizeof(GLuint), 0, GL_DYNAMIC_COPY);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleLightBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (reserved + tilePoolCapacity) * sizeof(GLuint), 0, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visibleLightBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, tileGridBuffer);
+
+	glUseProgram(lightCullShader.program);
+	lightCullShader.setUniform("reservedLights", GLuint(TILE_RESERVED_LIGHTS));
+	lightCullShader.setUniform("poolCapacity", GLuint(tilePoolCapacity));
+	glUseProgram(lightCullSuperTileShader.program);
+	lightCullSuperTileShader.setUniform("reservedLights", GLuint(TILE_RESERVED_LIGHTS));
+	lightCullSuperTileShader.setUniform("poolCapacity", GLuint(tilePoolCapacity));
+	glUseProgram(0);
+}
+
+void resizeClusterBuffers()
+{
+	// Each cluster tile's own region, then the shared pool
+	GLsizeiptr reserved = clustersX * clustersY * CLUSTER_RESERVED_LIGHTS;
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterLightBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (reserved + clusterPoolCapacity) * sizeof(GLuint), 0, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, clusterLightBuffer);
+
+	glUseProgram(clusterCullShader.program);
+	clusterCullShader.setUniform("reservedLights", GLuint(CLUSTER_RESERVED_LIGHTS));
+	clusterCullShader.setUniform("poolCapacity", GLuint(clusterPoolCapacity));
+	glUseProgram(0);
+}
+
+void growListPools()
 {
-	if (!moveLights && visibleLightBuffer) return;
+	// The culling passes count what the lists ask for from the pool,
+	// even past its end. Lists that didn't fit were cut down to their
+	// tile's own region, so once that is read back, the pool grows to
+	// fit them with some room to spare. No tile needs more than
+	// MAX_TILE_LIGHTS, while cluster lists can get much longer
+	const TileStats &stats = getTileStats();
+	GLuint needed = stats.poolLights + stats.poolLights / 4;
+
+	if (!stats.clusters && stats.poolLights > GLuint(tilePoolCapacity))
+	{
+		int maxCapacity = tilesX * tilesY * MAX_TILE_LIGHTS;
+		if (tilePoolCapacity >= maxCapacity) return;
+
+		tilePoolCapacity = int(glm::min(needed, GLuint(maxCapacity)));
+		resizeTileBuffers();
+	}
+	else if (stats.clusters && stats.poolLights > GLuint(clusterPoolCapacity))
+	{
+		if (clusterPoolCapacity >= MAX_CLUSTER_POOL_LIGHTS) return;
+
+		clusterPoolCapacity = int(glm::min(needed, GLuint(MAX_CLUSTER_POOL_LIGHTS)));
+		resizeClusterBuffers();
+	}
+}
+
+void resetListCounters()
+{
+	GLuint zero[3] = {0, 0, 0};
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightListCounterBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), zero);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void createLightBuffers()
+{
+	// Light and light index buffers, used in lightCullShader and lightShader
+	// Each tile has an offset and count into visibleLightBuffer, which holds
+	// the light lists of all tiles. Lists longer than a tile's own region
+	// are allocated from the shared pool at its end through the counter
+	// in lightListCounterBuffer, see Shaders/listPool.in. Buffers sized
+	// by the light count are allocated in resizeLightBuffers, the ones
+	// sized by the tile count in resizeTileBuffers
+	glGenBuffers(1, &visibleLightBuffer);
+	glGenBuffers(1, &tileGridBuffer);
+	glGenBuffers(1, &lightListCounterBuffer);
+	glGenBuffers(1, &frustumLightBuffer);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightListCounterBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, 3 * sizeof(GLuint), 0, GL_DYNAMIC_COPY);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, lightListCounterBuffer);
+
+	// Super-tile lists, filled by superTileCullShader
+	glGenBuffers(1, &superTileGridBuffer);
+	glGenBuffers(1, &superTileLightBuffer);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, superTileGridBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, superTilesX * superTilesY * sizeof(GLuint), 0, GL_DYNAMIC_COPY);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, superTileGridBuffer);
+
+	// Same layout for clusters, with each cluster tile's lists in
+	// its own region of clusterLightBuffer or in the pool after them
+	glGenBuffers(1, &clusterGridBuffer);
+	glGenBuffers(1, &clusterLightBuffer);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterGridBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, clustersX * clustersY * CLUSTER_SLICES * 2 * sizeof(GLuint), 0, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, clusterGridBuffer);
+	resizeClusterBuffers();
+
+	// Buffers for animating the lights on the GPU
+	glGenBuffers(1, &gpuLightBuffer);
+	glGenBuffers(1, &lightStateBuffer);
+
+	resizeTileBuffers();
+}
+
+void resizeLightBuffers()
+{
+	// The light ring has immutable storage, so it is replaced. The GL
+	// keeps the old one alive until the frames reading it are done
+	for (int i = 0; i < LIGHT_BUFFER_FRAMES; i++)
+	{
+		if (lightFences[i]) glDeleteSync(lightFences[i]);
+		lightFences[i] = 0;
+	}
+
+	if (lightBuffer)
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightBuffer);
+		if (lightRing) glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+		glDeleteBuffers(1, &lightBuffer);
+		lightRing = nullptr;
+	}
+	glGenBuffers(1, &lightBuffer);
+
+	// Segments start at offsets the SSBO range bindings accept
+	GLint alignment = 1;
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	lightSegmentSize = (lightCapacity * sizeof(Light) + alignment - 1) / alignment * alignment;
 
-	// Update light positions
-	for (unsigned i = 0; i < lightCount; i++)
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightBuffer);
+	if (GLEW_ARB_buffer_storage)
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_SHADER_STORAGE_BUFFER, lightSegmentSize * LIGHT_BUFFER_FRAMES, 0, flags);
+		lightRing = (Light*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, lightSegmentSize * LIGHT_BUFFER_FRAMES, flags);
+	}
+	else
 	{
-		lights[i].positionRadius += vec4(normalize(lightTargets[i] - vec3(lights[i].positionRadius))
-									* float(deltaTime) * float(i%1024) / 100.0f, 0.0);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, lightSegmentSize * LIGHT_BUFFER_FRAMES, 0, GL_DYNAMIC_DRAW);
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, frustumLightBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (lightCapacity + 1) * sizeof(GLuint), 0, GL_DYNAMIC_COPY);
+
+	superTileLights = glm::min(lightCapacity, MAX_SUPER_TILE_LIGHTS);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, superTileLightBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, superTilesX * superTilesY * superTileLights * sizeof(GLuint), 0, GL_DYNAMIC_COPY);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuLightBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, lightCapacity * sizeof(Light), 0, GL_DYNAMIC_COPY);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightStateBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, lightCapacity * sizeof(LightState), 0, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, lightStateBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, frustumLightBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, superTileLightBuffer);
+
+	glUseProgram(superTileCullShader.program);
+	superTileCullShader.setUniform("maxSuperTileLights", GLuint(superTileLights));
+	glUseProgram(lightCullSuperTileShader.program);
+	lightCullSuperTileShader.setUniform("maxSuperTileLights", GLuint(superTileLights));
+	glUseProgram(shadeSuperTilesShader.program);
+	shadeSuperTilesShader.setUniform("maxSuperTileLights", GLuint(superTileLights));
+	glUseProgram(0);
 
-		if (glm::distance2(vec3(lights[i].positionRadius), lightTargets[i]) < 0.1)
+	lightSegment = 0;
+	uploadedLightCount = -1;
+}
+
+void animateLightsOnGPU()
+{
+	// The lights move to the GPU once, after which they are only
+	// read back when switching back to the CPU
+	if (!lightsOnGPU || uploadedLightCount < 0)
+	{
+		vector<Light> lights(lightCapacity);
+		vector<LightState> states(lightCapacity);
+		packLights(lightStore, 0, lightCapacity, &lights[0]);
+		for (int i = 0; i < lightCapacity; i++)
 		{
-			lightTargets[i] = vec3(getRand(model.bb.min.x, model.bb.max.x),
-								   getRand(model.bb.min.y, model.bb.max.y),
-								   getRand(model.bb.min.z, model.bb.max.z));
+			states[i].target = vec3(lightStore.targetX[i], lightStore.targetY[i], lightStore.targetZ[i]);
+			states[i].retargets = lightStore.retargets[i];
 		}
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuLightBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, lightCapacity * sizeof(Light), &lights[0]);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightStateBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, lightCapacity * sizeof(LightState), &states[0]);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		lightsOnGPU = true;
+		uploadedLightCount = lightCapacity;
+	}
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, gpuLightBuffer);
+
+	if (!moveLights || lightCount == 0) return;
+
+	beginPass(PASS_LIGHT_ANIMATION);
+
+	glUseProgram(lightAnimationShader.program);
+	lightAnimationShader.setUniform("deltaTime", float(deltaTime));
+	lightAnimationShader.setUniform("seed", GLuint(LIGHT_SEED));
+	lightAnimationShader.setUniform("boxMin", model.bb.min);
+	lightAnimationShader.setUniform("boxMax", model.bb.max);
+	glDispatchCompute((lightCount + 63) / 64, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	endPass(PASS_LIGHT_ANIMATION);
+}
+
+void readBackLights(int count)
+{
+	if (count == 0) return;
+
+	vector<Light> lights(count);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuLightBuffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(Light), &lights[0]);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	unpackLights(lightStore, 0, count, &lights[0]);
+}
+
+void stopLightsOnGPU()
+{
+	// Continue on the CPU from where the GPU left off
+	vector<LightState> states(lightCapacity);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightStateBuffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, lightCapacity * sizeof(LightState), &states[0]);
+	readBackLights(lightCapacity);
+
+	for (int i = 0; i < lightCapacity; i++)
+	{
+		lightStore.targetX[i] = states[i].target.x;
+		lightStore.targetY[i] = states[i].target.y;
+		lightStore.targetZ[i] = states[i].target.z;
+		lightStore.retargets[i] = states[i].retargets;
 	}
 
-	if (!visibleLightBuffer)
+	lightsOnGPU = false;
+	uploadedLightCount = -1;
+}
+
+void growLights()
+{
+	int capacity = glm::max(lightCapacity, INITIAL_LIGHT_CAPACITY);
+	while (capacity < lightCount) capacity *= 2;
+
+	// Lights on the GPU are read back, and moved to the
+	// new buffers on the next animation step
+	if (lightsOnGPU) stopLightsOnGPU();
+
+	generateLights(lightStore, lightCapacity, capacity, LIGHT_SEED, model.bb.min, model.bb.max);
+	lightCapacity = capacity;
+
+	resizeLightBuffers();
+}
+
+void updateLights()
+{
+	if (!visibleLightBuffer) createLightBuffers();
+	if (lightCapacity == 0 || lightCount > lightCapacity) growLights();
+
+	if (gpuLightAnimation)
 	{
-		// Light and light index buffers, used in lightCullShader and lightShader
-		glGenBuffers(1, &lightBuffer);
-		glGenBuffers(1, &visibleLightBuffer);
+		animateLightsOnGPU();
+		return;
+	}
+	else if (lightsOnGPU)
+	{
+		stopLightsOnGPU();
+	}
 
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleLightBuffer);
-		glBufferData(GL_SHADER_STORAGE_BUFFER, ((width+15)/16) * ((width+15)/16) * 1024 * sizeof(GLuint), 0, GL_DYNAMIC_COPY);
+	// Still lights are uploaded again only when some are added
+	if (!moveLights && lightCount <= uploadedLightCount) return;
 
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, lightBuffer);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visibleLightBuffer);
+	if (moveLights)
+	{
+		Uint64 start = SDL_GetPerformanceCounter();
+		animateLights(lightStore, lightCount, deltaTime, LIGHT_SEED, model.bb.min, model.bb.max);
+		lightUpdateTime = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
 	}
 
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightBuffer);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, MAX_LIGHT_COUNT * sizeof(Light), &lights[0], GL_DYNAMIC_COPY);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	uploadLights();
 }
 
-void generateLights()
+void updateFrameData()
 {
-	srand(LIGHT_SEED);
+	FrameData frame;
+	frame.viewProjection = camera.getViewProjection();
+	frame.inverseViewProjection = glm::inverse(frame.viewProjection);
+	frame.view = camera.getView();
+	frame.projection = camera.projection;
+	frame.cameraPosition = camera.position;
+	frame.zNear = CAMERA_Z_NEAR;
+	frame.screenSize = vec2(width, height);
+	frame.zFar = CAMERA_Z_FAR;
+	frame.lightCount = lightCount;
+
+	glBindBuffer(GL_UNIFORM_BUFFER, frameDataBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameData), &frame);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
 
-	// Generate the maximum number of allowed lights,
+void generateLights()
+{
+	// Generate as many lights as the buffers hold,
 	// even if we don't render all of them
-	vec3 dims = model.bb.max - model.bb.min;
-	float maxDim = glm::max(glm::max(dims.x, dims.y), dims.z);
+	generateLights(lightStore, 0, lightCapacity, LIGHT_SEED, model.bb.min, model.bb.max);
+	uploadedLightCount = -1;
+}
+
+// Legend in pixels from the bottom left, x and y of its
+// corner followed by its width and height
+vec4 getHeatmapLegendRect()
+{
+	return vec4(width - HEATMAP_LEGEND_WIDTH - HEATMAP_LEGEND_RIGHT, HEATMAP_LEGEND_BOTTOM,
+				HEATMAP_LEGEND_WIDTH, HEATMAP_LEGEND_HEIGHT);
+}
+
+void setHeatmapUniforms(Shader &shader)
+{
+	shader.setUniform("heatmapMax", float(HEATMAP_MAX_LIGHTS));
+	shader.setUniform("legendRect", getHeatmapLegendRect());
+}
+
+void setSuperTileUniforms(Shader &shader)
+{
+	shader.setUniform("superTileSize", SUPER_TILE_SIZE);
+	shader.setUniform("superTilesX", superTilesX);
+}
+
+void setClusterUniforms(Shader &shader)
+{
+	shader.setUniform("clusterCount", ivec3(clustersX, clustersY, CLUSTER_SLICES));
+	shader.setUniform("clusterTileSize", CLUSTER_TILE_SIZE);
+	shader.setUniform("clusterNear", CLUSTER_Z_NEAR);
+	shader.setUniform("clusterFar", CAMERA_Z_FAR);
+}
+
+void loadTileShaders()
+{
+	// Each tile size has its own variant, compiled the first time it's used
+	vector<string> tileDefines = {"TILE_SIZE " + std::to_string(tileSize)};
+
+	// lightCullShader: Lists the lights touching each tile
+	lightCullShader = getShader("Shaders/lightCull", tileDefines);
+	glUseProgram(lightCullShader.program);
+	lightCullShader.setUniform("depthMap", 0);
+	lightCullShader.setUniform("tilesX", tilesX);
+
+	// lightCullSuperTileShader: Same, testing only the lights of the tile's super-tile
+	lightCullSuperTileShader = getShader("Shaders/lightCull", {tileDefines[0], "SUPER_TILES"});
+	glUseProgram(lightCullSuperTileShader.program);
+	lightCullSuperTileShader.setUniform("depthMap", 0);
+	lightCullSuperTileShader.setUniform("tilesX", tilesX);
+	lightCullSuperTileShader.setUniform("maxSuperTileLights", GLuint(superTileLights));
+	setSuperTileUniforms(lightCullSuperTileShader);
+
+	// shadeTilesShader, shadeSuperTilesShader: Same, keeping each tile's
+	// list in shared memory to shade its pixels from the GBuffer
+	shadeTilesShader = getShader("Shaders/lightCull", {tileDefines[0], "SHADE_TILES"});
+	glUseProgram(shadeTilesShader.program);
+	shadeTilesShader.setUniform("depthMap", 0);
+	shadeTilesShader.setUniform("gNormal", 1);
+	shadeTilesShader.setUniform("gAlbedoSpec", 2);
+	shadeTilesShader.setUniform("tilesX", tilesX);
+	shadeTilesShader.setUniform("clearColor", CLEAR_COLOR);
+
+	shadeSuperTilesShader = getShader("Shaders/lightCull", {tileDefines[0], "SUPER_TILES", "SHADE_TILES"});
+	glUseProgram(shadeSuperTilesShader.program);
+	shadeSuperTilesShader.setUniform("depthMap", 0);
+	shadeSuperTilesShader.setUniform("gNormal", 1);
+	shadeSuperTilesShader.setUniform("gAlbedoSpec", 2);
+	shadeSuperTilesShader.setUniform("tilesX", tilesX);
+	shadeSuperTilesShader.setUniform("clearColor", CLEAR_COLOR);
+	shadeSuperTilesShader.setUniform("maxSuperTileLights", GLuint(superTileLights));
+	setSuperTileUniforms(shadeSuperTilesShader);
+
+	forwardPlusShader = getShader("Shaders/forwardPlus", tileDefines);
+	glUseProgram(forwardPlusShader.program);
+	forwardPlusShader.setUniform("tilesX", tilesX);
 
-	for (int i = 0; i < MAX_LIGHT_COUNT; i++)
+	deferredTiledShader = getShader("Shaders/deferredTiled", tileDefines);
+	glUseProgram(deferredTiledShader.program);
+	deferredTiledShader.setUniform("gNormal", 0);
+	deferredTiledShader.setUniform("gAlbedoSpec", 1);
+	deferredTiledShader.setUniform("depthMap", 2);
+	deferredTiledShader.setUniform("tilesX", tilesX);
+
+	screenLightHeatmapShader = getShader("Shaders/screenLightHeatmap", tileDefines);
+	glUseProgram(screenLightHeatmapShader.program);
+	screenLightHeatmapShader.setUniform("tilesX", tilesX);
+	setHeatmapUniforms(screenLightHeatmapShader);
+	glUseProgram(0);
+}
+
+void setTileSize(int size)
+{
+	// The lists' total length follows the tile count, so the
+	// pool is scaled with it rather than grown again
+	int tileCount = tilesX * tilesY;
+
+	tileSize = size;
+	tilesX = (width + tileSize - 1) / tileSize;
+	tilesY = (height + tileSize - 1) / tileSize;
+
+	if (tileCount > 0)
 	{
-		lights[i].positionRadius = vec4(getRand(model.bb.min.x, model.bb.max.x),
-										getRand(model.bb.min.y, model.bb.max.y),
-										getRand(model.bb.min.z, model.bb.max.z),
-										getRand(maxDim/50.0f, maxDim/5.0f));
-		lights[i].colorSpec = vec4(getRand(0, 1),
-								   getRand(0, 1),
-								   getRand(0, 1),
-								   getRand(0, 1));
-		lightTargets[i] = vec3(getRand(model.bb.min.x, model.bb.max.x),
-							   getRand(model.bb.min.y, model.bb.max.y),
-							   getRand(model.bb.min.z, model.bb.max.z));
+		tilePoolCapacity = glm::max(int(double(tilePoolCapacity) * tilesX * tilesY / tileCount), INITIAL_TILE_POOL_LIGHTS);
 	}
+
+	loadTileShaders();
+	resizeTileStats(glm::max(tilesX * tilesY, clustersX * clustersY));
+
+	// Before the first frame the light buffers don't exist
+	// yet, createLightBuffers sizes these when it makes them
+	if (visibleLightBuffer) resizeTileBuffers();
 }
 
 void initialize()
@@ -205,59 +816,81 @@ void initialize()
 		{0, 1, 2, 0, 2, 3});
 
 
+	// Camera and screen uniforms shared by all shaders
+	glGenBuffers(1, &frameDataBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, frameDataBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameData), 0, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, 0, frameDataBuffer);
+
+
+	// Worker threads, used to decode textures and build their mipmaps
+	initThreadPool();
+
+
 	// Load models
 	for (unsigned int i = 0, l = sizeof(ModelStr) / sizeof(ModelStr[0]); i < l; i++)
 	{
 		models.push_back(loadModel(ModelStr[i]));
+		setTextureFilter(models.back(), textureFilter);
 	}
-	model = models[0];
+	model = models[curModel];
 	sphere = loadModel("Models/Sphere.nff");
 
+	// Textures were decoded while the models loaded, upload the rest
+	updateTextures(true);
 
-	// Generate lights
-	generateLights();
-	updateLights();
+
+	initProfiler(gpuLogFile);
+	initTileStats(tileStatsLogFile);
 
 
 	// Load shaders
-	// colorShader: Renders a model in a single color
+	// colorShader: Renders a sphere at each light, in its color
 	colorShader = getShader("Shaders/color");
+	glUseProgram(colorShader.program);
+	colorShader.setUniform("sphereScale", LIGHT_SPHERE_SCALE);
 
 	// depthShader: Renders scene to depth buffer
 	depthShader = getShader("Shaders/depth");
 
-	lightCullShader = getShader("Shaders/lightCull");
-	glUseProgram(lightCullShader.program);
-	lightCullShader.setUniform("projection", camera.projection);
-	lightCullShader.setUniform("screenSize", vec2(width, height));
-	lightCullShader.setUniform("zNear", CAMERA_Z_NEAR);
-	lightCullShader.setUniform("zFar", CAMERA_Z_FAR);
-	lightCullShader.setUniform("depthMap", 0);
+	// lightFrustumCullShader: Lists the lights inside the view frustum
+	lightFrustumCullShader = getShader("Shaders/lightFrustumCull");
 
-	forwardShader = getShader("Shaders/forward");
+	// superTileCullShader: Lists the lights touching each super-tile
+	superTileCullShader = getShader("Shaders/superTileCull");
+	glUseProgram(superTileCullShader.program);
+	superTileCullShader.setUniform("depthMap", 0);
+	setSuperTileUniforms(superTileCullShader);
 
-	forwardPlusShader = getShader("Shaders/forwardPlus");
-	glUseProgram(forwardPlusShader.program);
-	forwardPlusShader.setUniform("tilesX", ((width+15)/16));
-	forwardPlusShader.setUniform("screenSize", vec2(width, height));
+	// Shaders working on screen tiles, see loadTileShaders
+	setTileSize(tileSize);
+
+	forwardShader = getShader("Shaders/forward");
 
 	deferredGBufferShader = getShader("Shaders/deferredGBuffer");
 
 	deferredShader = getShader("Shaders/deferred");
 	glUseProgram(deferredShader.program);
-	deferredShader.setUniform("gPosition", 0);
-	deferredShader.setUniform("gNormal", 1);
-	deferredShader.setUniform("gAlbedoSpec", 2);
-	deferredShader.setUniform("depthMap", 3);
-
-	deferredTiledShader = getShader("Shaders/deferredTiled");
-	glUseProgram(deferredTiledShader.program);
-	deferredTiledShader.setUniform("gPosition", 0);
-	deferredTiledShader.setUniform("gNormal", 1);
-	deferredTiledShader.setUniform("gAlbedoSpec", 2);
-	deferredTiledShader.setUniform("depthMap", 3);
-	deferredTiledShader.setUniform("tilesX", ((width+15)/16));
-	deferredTiledShader.setUniform("screenSize", vec2(width, height));
+	deferredShader.setUniform("gNormal", 0);
+	deferredShader.setUniform("gAlbedoSpec", 1);
+	deferredShader.setUniform("depthMap", 2);
+
+	// clusterCullShader: Assigns lights to the clusters they overlap
+	clusterCullShader = getShader("Shaders/clusterCull");
+	glUseProgram(clusterCullShader.program);
+	setClusterUniforms(clusterCullShader);
+
+	forwardClusteredShader = getShader("Shaders/forwardClustered");
+	glUseProgram(forwardClusteredShader.program);
+	setClusterUniforms(forwardClusteredShader);
+
+	deferredClusteredShader = getShader("Shaders/deferredClustered");
+	glUseProgram(deferredClusteredShader.program);
+	deferredClusteredShader.setUniform("gNormal", 0);
+	deferredClusteredShader.setUniform("gAlbedoSpec", 1);
+	deferredClusteredShader.setUniform("depthMap", 2);
+	setClusterUniforms(deferredClusteredShader);
 
 	// screenTextureShader: Renders a texture to screen
 	screenTextureShader = getShader("Shaders/screenTexture");
@@ -269,20 +902,36 @@ void initialize()
 	screenDepthShader = getShader("Shaders/screenDepthmap");
 	glUseProgram(screenDepthShader.program);
 	screenDepthShader.setUniform("depthMap", 0);
-	screenDepthShader.setUniform("zNear", CAMERA_Z_NEAR);
-	screenDepthShader.setUniform("zFar", CAMERA_Z_FAR);
-
-	screenLightHeatmapShader = getShader("Shaders/screenLightHeatmap");
-	glUseProgram(screenLightHeatmapShader.program);
-	screenLightHeatmapShader.setUniform("tilesX", ((width+15)/16));
 
-	// screenAbsTextureShader: Renders scaled, absolute pixel
-	// colors from a texture to screen
-	screenAbsTextureShader = getShader("Shaders/screenAbsTexture");
-	glUseProgram(screenAbsTextureShader.program);
-	screenAbsTextureShader.setUniform("screenTexture", 0);
+	screenClusterHeatmapShader = getShader("Shaders/screenLightHeatmap", {"CLUSTERED"});
+	glUseProgram(screenClusterHeatmapShader.program);
+	screenClusterHeatmapShader.setUniform("depthMap", 0);
+	setClusterUniforms(screenClusterHeatmapShader);
+	setHeatmapUniforms(screenClusterHeatmapShader);
+
+	// screenGBufferShader: Renders scaled, absolute positions
+	// or normals decoded from the GBuffer to screen
+	screenGBufferShader = getShader("Shaders/screenGBuffer");
+	glUseProgram(screenGBufferShader.program);
+	screenGBufferShader.setUniform("gNormal", 0);
+	screenGBufferShader.setUniform("depthMap", 1);
 	glUseProgram(0);
 
+	// hiZCopyShader, hiZDownsampleShader: Build the Hi-Z pyramid
+	hiZCopyShader = getShader("Shaders/hiZ", {"COPY_DEPTH"});
+	glUseProgram(hiZCopyShader.program);
+	hiZCopyShader.setUniform("depthMap", 0);
+
+	hiZDownsampleShader = getShader("Shaders/hiZ");
+
+	// lightAnimationShader: Moves the lights when they are animated on the GPU
+	lightAnimationShader = getShader("Shaders/lightAnimation");
+
+	// occlusionCullShader: Removes draws hidden in the Hi-Z pyramid
+	occlusionCullShader = getShader("Shaders/occlusionCull");
+	glUseProgram(occlusionCullShader.program);
+	occlusionCullShader.setUniform("hiZ", 0);
+
 
 	// Framebuffer for depth map
 	glGenFramebuffers(1, &depthFBO);
@@ -310,25 +959,42 @@ void initialize()
 	}
 
 
+	// Hi-Z pyramid, a full mip chain of the depth map
+	while ((glm::max(width, height) >> hiZLevels) > 0) hiZLevels++;
+
+	glGenTextures(1, &hiZTexture);
+	glBindTexture(GL_TEXTURE_2D, hiZTexture);
+	glTexStorage2D(GL_TEXTURE_2D, hiZLevels, GL_R32F, width, height);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glUseProgram(occlusionCullShader.program);
+	occlusionCullShader.setUniform("hiZLevels", hiZLevels);
+	glUseProgram(0);
+
+
 	// GBuffer for deferred shading
 	glGenFramebuffers(1, &gFBO);
 	glBindFramebuffer(GL_FRAMEBUFFER, gFBO);
 
-	//	Position buffer
-	glGenTextures(1, &gPositionTex);
-	glBindTexture(GL_TEXTURE_2D, gPositionTex);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, width, height, 0, GL_RGB, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gPositionTex, 0);
+	// Positions aren't stored, the deferred shaders reconstruct
+	// them from the depth buffer
 
-	//	Normal buffer
+	//	Normal buffer, octahedral encoded. Unorm because snorm
+	//	formats don't have to be renderable
 	glGenTextures(1, &gNormalTex);
 	glBindTexture(GL_TEXTURE_2D, gNormalTex);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, NULL);
+	if (gBufferFormat == GBUFFER_RGB10A2)
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB10_A2, width, height, 0, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV, NULL);
+	else
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16, width, height, 0, GL_RG, GL_UNSIGNED_SHORT, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gNormalTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gNormalTex, 0);
 
 	//	Color + Specular buffer
 	glGenTextures(1, &gColSpecTex);
@@ -336,72 +1002,306 @@ void initialize()
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, gColSpecTex, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gColSpecTex, 0);
 
 	// Depth buffer
 	glBindTexture(GL_TEXTURE_2D, depthTexture);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
 
-	GLuint attachments[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
-	glDrawBuffers(3, attachments);
+	GLuint attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, attachments);
 
 	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 	{
 		cerr<<"Error creating GBuffer"<<endl;
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	// Compute Tiled Deferred output, only read by blits
+	glGenTextures(1, &shadedTexture);
+	glBindTexture(GL_TEXTURE_2D, shadedTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+
+	glGenFramebuffers(1, &shadedFBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, shadedFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, shadedTexture, 0);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		cerr<<"Error creating compute shading framebuffer"<<endl;
+	}
+
+	// Offscreen framebuffer for headless mode, since a surfaceless
+	// context has no default framebuffer to render to
+	if (headless)
+	{
+		glGenFramebuffers(1, &screenFBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, screenFBO);
+
+		glGenRenderbuffers(1, &screenColorRBO);
+		glBindRenderbuffer(GL_RENDERBUFFER, screenColorRBO);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, screenColorRBO);
+
+		// Same format as depthTexture, so the depth blit for light spheres works
+		glGenRenderbuffers(1, &screenDepthRBO);
+		glBindRenderbuffer(GL_RENDERBUFFER, screenDepthRBO);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32, width, height);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, screenDepthRBO);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			cerr<<"Error creating offscreen framebuffer"<<endl;
+		}
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, screenFBO);
+
+
+	// Generate lights, after the shaders since they may be animated on the GPU
+	generateLights();
+	updateFrameData();
+	updateLights();
 }
 
 void deinitialize()
 {
+	clearProfiler();
+	clearTileStats();
+	clearThreadPool();
+
+	for (int i = 0; i < LIGHT_BUFFER_FRAMES; i++)
+	{
+		if (lightFences[i]) glDeleteSync(lightFences[i]);
+	}
+
+	glDeleteBuffers(1, &frameDataBuffer);
 	glDeleteBuffers(1, &lightBuffer);
 	glDeleteBuffers(1, &visibleLightBuffer);
+	glDeleteBuffers(1, &tileGridBuffer);
+	glDeleteBuffers(1, &lightListCounterBuffer);
+	glDeleteBuffers(1, &clusterGridBuffer);
+	glDeleteBuffers(1, &clusterLightBuffer);
+	glDeleteBuffers(1, &frustumLightBuffer);
+	glDeleteBuffers(1, &superTileGridBuffer);
+	glDeleteBuffers(1, &superTileLightBuffer);
+	glDeleteBuffers(1, &gpuLightBuffer);
+	glDeleteBuffers(1, &lightStateBuffer);
 
 	glDeleteFramebuffers(1, &depthFBO);
 	glDeleteTextures(1, &depthTexture);
+	glDeleteTextures(1, &hiZTexture);
+
+	glDeleteFramebuffers(1, &gFBO);
+	glDeleteRenderbuffers(1, &gRBO);
+	glDeleteTextures(1, &gNormalTex);
+	glDeleteTextures(1, &gColSpecTex);
+
+	glDeleteFramebuffers(1, &shadedFBO);
+	glDeleteTextures(1, &shadedTexture);
+
+	if (headless)
+	{
+		glDeleteFramebuffers(1, &screenFBO);
+		glDeleteRenderbuffers(1, &screenColorRBO);
+		glDeleteRenderbuffers(1, &screenDepthRBO);
+	}
+}
+
+void renderGeometry(Shader &shader, bool bindMaterials = true)
+{
+	glUseProgram(shader.program);
+
+	beginGeometryQuery();
+	drawModel(model, shader, bindMaterials);
+	endGeometryQuery();
+}
+
+void buildHiZ()
+{
+	// Level 0 is a copy of the depth map, every other level
+	// holds the farthest depth of 2x2 texels of the one below
+	glUseProgram(hiZCopyShader.program);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, depthTexture);
+	glBindImageTexture(1, hiZTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+	glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+
+	glUseProgram(hiZDownsampleShader.program);
+	for (int level = 1; level < hiZLevels; level++)
+	{
+		int levelWidth = glm::max(width >> level, 1);
+		int levelHeight = glm::max(height >> level, 1);
+
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		glBindImageTexture(0, hiZTexture, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		glBindImageTexture(1, hiZTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glDispatchCompute((levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+	}
+
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	hiZValid = true;
+	hiZModel = curModel;
+	hiZViewProjection = camera.getViewProjection();
+}
+
+void cullOccludedMeshes()
+{
+	// Test the meshes that survived frustum culling against last
+	// frame's depth, as seen from last frame's camera. Meshes that
+	// come into view from behind an occluder show up a frame late
+	if (model.visibleMeshes == 0) return;
+
+	glUseProgram(occlusionCullShader.program);
+	occlusionCullShader.setUniform("commandCount", GLuint(model.visibleMeshes));
+	occlusionCullShader.setUniform("previousViewProjection", hiZViewProjection);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, hiZTexture);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, model.meshBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, model.indirectBuffer);
+
+	glDispatchCompute((model.visibleMeshes + 63) / 64, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void cullLightsToFrustum()
+{
+	// Lists the lights inside the view frustum, so the per tile
+	// culling passes only loop over the ones that can be visible
+	GLuint zero = 0;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, frustumLightBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &zero);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glUseProgram(lightFrustumCullShader.program);
+	glDispatchCompute((lightCount + 255) / 256, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// Forward+, Tiled Deferred and Compute Tiled Deferred cull lights
+// per tile with lightCull.cs
+bool usesLightTiles()
+{
+	return (technique == TECHNIQUE_FORWARD_PLUS || technique == TECHNIQUE_DEFERRED_TILED ||
+			technique == TECHNIQUE_DEFERRED_COMPUTE);
+}
+
+void startTileTuningStep()
+{
+	// Frames from the next one on are rendered with this size
+	tileTuneFirstFrame = getProfilerFrame();
+	tileTuneSamples = 0;
+	tileTuneTimes[tileTuneStep] = 0.0;
+	setTileSize(TileSizes[tileTuneStep]);
+}
+
+void startTileTuning()
+{
+	if (!usesLightTiles())
+	{
+		cerr<<"Tile size auto-tuning needs a tiled technique"<<endl;
+		return;
+	}
+
+	tileTuneStep = 0;
+	startTileTuningStep();
+}
+
+void updateTileTuning()
+{
+	if (tileTuneStep < 0) return;
+
+	// Stop when switching to a technique without tiles
+	if (!usesLightTiles())
+	{
+		tileTuneStep = -1;
+		return;
+	}
+
+	// Time the whole frame, as the tile size changes the cost of both
+	// culling and shading. Pass times arrive a few frames late and stay
+	// the same until newer ones land, so count each frame only once
+	int frame = getTimedFrame();
+	if (frame < tileTuneFirstFrame + TILE_TUNE_SKIP_FRAMES || frame == tileTuneLastFrame) return;
+	tileTuneLastFrame = frame;
+
+	tileTuneTimes[tileTuneStep] += getTotalPassTime() / TILE_TUNE_FRAMES;
+	if (++tileTuneSamples < TILE_TUNE_FRAMES) return;
+
+	if (++tileTuneStep < TILE_SIZE_COUNT)
+	{
+		startTileTuningStep();
+		return;
+	}
+
+	int best = 0;
+	cout<<"Tile size auto-tuning, "<<TechniqueStr[technique]<<", "<<lightCount<<" lights, "<<width<<"x"<<height<<":"<<endl;
+	for (int i = 0; i < TILE_SIZE_COUNT; i++)
+	{
+		cout<<"  "<<TileSizes[i]<<"x"<<TileSizes[i]<<": "<<tileTuneTimes[i]<<" ms"<<endl;
+		if (tileTuneTimes[i] < tileTuneTimes[best]) best = i;
+	}
+	cout<<"  Using "<<TileSizes[best]<<"x"<<TileSizes[best]<<" tiles"<<endl;
 
-	glDeleteFramebuffers(1, &gFBO);
-	glDeleteRenderbuffers(1, &gRBO);
-	glDeleteTextures(1, &gPositionTex);
-	glDeleteTextures(1, &gNormalTex);
-	glDeleteTextures(1, &gColSpecTex);
+	tileTuneStep = -1;
+	setTileSize(TileSizes[best]);
 }
 
-void renderGeometry(Shader &shader)
+void shadeTiles()
 {
-	glUseProgram(shader.program);
-	shader.setUniform("lightCount", lightCount);
-	shader.setUniform("viewProjection", camera.getViewProjection());
-	shader.setUniform("cameraPosition", camera.position);
+	// Cull each tile's lights and shade its pixels from the GBuffer
+	// in one dispatch, so the lists never leave shared memory
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, depthTexture);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, gNormalTex);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, gColSpecTex);
+	glBindImageTexture(0, shadedTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
 
-	for (unsigned int i = 0; i < model.meshes.size(); i++)
-	{
-		bindMaterial(model.meshes[i].material, shader);
+	resetListCounters();
 
-		glBindVertexArray(model.meshes[i].vao);
-		shader.setUniform("model", model.meshes[i].transform);
-		glDrawElements(GL_TRIANGLES, model.meshes[i].elements, GL_UNSIGNED_INT, 0);
-	}
+	Shader &shader = superTileCulling? shadeSuperTilesShader: shadeTilesShader;
+	glUseProgram(shader.program);
+	shader.setUniform("depthMaskCulling", depthMaskCulling[technique]);
+	glDispatchCompute(tilesX, tilesY, 1);
+	glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+	captureTileStats(tilesX * tilesY, false, lightListCounterBuffer);
 
-	glBindVertexArray(0);
+	glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// Copy the result to screen, next to the GBuffer textures
+	// when those are shown
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, shadedFBO);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, screenFBO);
+	if (outputMode == OUTPUT_GBUFFER)
+		glBlitFramebuffer(0,		0,	width,	height,
+						  width/2,	0,	width,	height/2,
+						  GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	else
+		glBlitFramebuffer(0, 0, width, height,
+						  0, 0, width, height,
+						  GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, screenFBO);
 }
 
 void renderLightsDebug()
 {
+	// One instance per light, read from the light buffer the
+	// shading passes use, wherever the lights were animated
 	glUseProgram(colorShader.program);
-	colorShader.setUniform("viewProjection", camera.getViewProjection());
-
-	for (unsigned int i = 0; i < lightCount; i++)
-	{
-		colorShader.setUniform("ambient", vec3(lights[i].colorSpec));
-		colorShader.setUniform("model", glm::translate(vec3(lights[i].positionRadius))
-									  * glm::scale(vec3(0.05 * lights[i].positionRadius.w)));
-
-		glBindVertexArray(sphere.meshes[0].vao);
-		glDrawElements(GL_TRIANGLES, sphere.meshes[0].elements, GL_UNSIGNED_INT, 0);
-	}
-
+	drawMeshInstanced(sphere, sphere.meshes[0], lightCount);
 	glBindVertexArray(0);
 }
 
@@ -414,13 +1314,99 @@ void renderHUD()
 	beginRenderText();
 
 	char status[1024];
-	snprintf(status, 1023, "Framerate: %.2f - Light count: %d - Output mode: %s - Technique: %s",
+	snprintf(status, 1023, "Framerate: %.2f - Light count: %d - Output mode: %s - Technique: %s - Textures: %s%s",
 			 framerate,
 			 lightCount,
 			 OutputModeStr[outputMode],
-			 TechniqueStr[technique]);
+			 TechniqueStr[technique],
+			 TextureFilterStr[textureFilter],
+			 recording? " - Recording camera path": "");
 	drawText(status, vec2(5, 5));
 
+	string timings = "GPU (ms):";
+	for (int i = 0; i < PASS_MAX; i++)
+	{
+		if (!wasPassTimed(GpuPass(i))) continue;
+
+		snprintf(status, 1023, " %s %.2f -", GpuPassStr[i], getPassTime(GpuPass(i)));
+		timings += status;
+	}
+	snprintf(status, 1023, " Total %.2f", getTotalPassTime());
+	timings += status;
+	drawText(timings, vec2(5, 31));
+
+	snprintf(status, 1023, "Meshes: %d visible - %d culled - Occlusion culling: %s - Triangles: %llu - Fragments: %llu - Uniform lookups avoided: %u",
+			 model.visibleMeshes,
+			 int(model.meshes.size()) - model.visibleMeshes,
+			 occlusionCulling? "on": "off",
+			 (unsigned long long)getTrianglesDrawn(),
+			 (unsigned long long)getFragmentsDrawn(),
+			 getUniformLookups());
+	drawText(status, vec2(5, 57));
+
+	char animation[256];
+	if (gpuLightAnimation)
+	{
+		snprintf(animation, 255, "GPU");
+	}
+	else if (moveLights)
+	{
+		snprintf(animation, 255, "CPU (%s, %u threads) %.2f ms",
+				 getLightKernelName(), getThreadCount() + 1, lightUpdateTime);
+	}
+	else
+	{
+		snprintf(animation, 255, "paused");
+	}
+
+	char tiles[64];
+	if (!usesLightTiles()) snprintf(tiles, 63, "n/a");
+	else if (tileTuneStep >= 0) snprintf(tiles, 63, "%dx%d, auto-tuning", tileSize, tileSize);
+	else snprintf(tiles, 63, "%dx%d", tileSize, tileSize);
+
+	snprintf(status, 1023, "Light animation: %s - Light culling: tiles %s, super-tiles %s, depth mask %s - GBuffer: %s normals, %.1f MB",
+			 animation,
+			 tiles,
+			 superTileCulling? "on": "off",
+			 !usesLightTiles()? "n/a": depthMaskCulling[technique]? "on": "off",
+			 GBufferFormatStr[gBufferFormat],
+			 double(width) * height * GBUFFER_BYTES_PER_PIXEL / 1e6);
+	drawText(status, vec2(5, 83));
+
+	// Read back a few frames late. For the tiled techniques, the
+	// mean is also the average length of the shading loop per pixel
+	bool clustered = (technique == TECHNIQUE_CLUSTERED || technique == TECHNIQUE_CLUSTERED_FORWARD);
+	if (usesLightTiles() || clustered)
+	{
+		const TileStats &stats = getTileStats();
+		snprintf(status, 1023, "Lights per %s: max %u - mean %.1f - p99 %u - Overflowed tiles: %d of %d - Dropped: %.2f%%",
+				 stats.clusters? "cluster tile": "tile",
+				 stats.max,
+				 stats.mean,
+				 stats.p99,
+				 stats.overflowed,
+				 stats.tiles,
+				 stats.listEntries? 100.0 * stats.droppedEntries / stats.listEntries: 0.0);
+		drawText(status, vec2(5, 109));
+	}
+
+	if (outputMode == OUTPUT_LIGHT_HEATMAP)
+	{
+		// Labels of the legend the heatmap shader draws
+		vec4 legend = getHeatmapLegendRect();
+		float top = height - legend.y - legend.w;
+		float bottom = height - legend.y;
+
+		drawText(clustered? "Lights per cluster": "Lights per tile", vec2(legend.x, top), 1.0, ANCHOR_BOTTOM);
+
+		snprintf(status, 1023, "%d", HEATMAP_MAX_LIGHTS / 2);
+		drawText("0", vec2(legend.x, bottom));
+		drawText(status, vec2(legend.x + legend.z / 2 - 15, bottom));
+		snprintf(status, 1023, "%d+", HEATMAP_MAX_LIGHTS);
+		drawText(status, vec2(legend.x + legend.z - 40, bottom));
+		drawText("Overflow", vec2(legend.x + legend.z * 1.05, bottom));
+	}
+
 	if (!showHelp)
 	{
 		drawText("F1   Toggle help", vec2(5, height - 5), 1.0, ANCHOR_BOTTOM);
@@ -434,6 +1420,14 @@ void renderHUD()
 				 "F5\n"
 				 "F6\n"
 				 "F7\n"
+				 "F8\n"
+				 "F9\n"
+				 "F10\n"
+				 "F11\n"
+				 "F12\n"
+				 "M\n"
+				 "T\n"
+				 "U\n"
 				 "+\n"
 				 "-\n"
 				 "W S A D / arrow keys\n"
@@ -446,8 +1440,16 @@ void renderHUD()
 				 "Change model\n"
 				 "Toggle moving lights\n"
 				 "Toggle light spheres\n"
-				 "Add 64 lights\n"
-				 "Remove 64 lights\n"
+				 "Start/stop recording camera path\n"
+				 "Toggle occlusion culling\n"
+				 "Change texture filtering\n"
+				 "Toggle light animation on GPU\n"
+				 "Toggle super-tile light culling\n"
+				 "Toggle depth mask light culling for this technique\n"
+				 "Change tile size\n"
+				 "Auto-tune tile size\n"
+				 "Double the light count\n"
+				 "Halve the light count\n"
 				 "Navigate\n"
 				 "Look", vec2(300, height - 5), 1.0, ANCHOR_BOTTOM);
 	}
@@ -457,10 +1459,21 @@ void renderHUD()
 
 void renderScene()
 {
-	updateLights();
-
-	bool needsGBuffer = (technique == TECHNIQUE_DEFERRED_TILED || technique == TECHNIQUE_DEFERRED);
-	bool needsLightCulling = (technique == TECHNIQUE_FORWARD_PLUS || technique == TECHNIQUE_DEFERRED_TILED);
+	beginProfilerFrame();
+	resetUniformLookups();
+	readTileStats();
+	growListPools();
+
+	bool needsGBuffer = (technique == TECHNIQUE_DEFERRED_TILED || technique == TECHNIQUE_DEFERRED || technique == TECHNIQUE_CLUSTERED ||
+						 technique == TECHNIQUE_DEFERRED_COMPUTE);
+	bool needsLightCulling = usesLightTiles();
+	// Compute Tiled Deferred culls while shading, and only
+	// writes the tile lists out for the heatmap
+	bool needsLightLists = needsLightCulling &&
+						   (technique != TECHNIQUE_DEFERRED_COMPUTE || outputMode == OUTPUT_LIGHT_HEATMAP);
+	bool needsClusterCulling = (technique == TECHNIQUE_CLUSTERED || technique == TECHNIQUE_CLUSTERED_FORWARD);
+	bool needsDepthPrepass = (technique == TECHNIQUE_FORWARD_PLUS || outputMode == OUTPUT_DEPTHMAP ||
+							  (technique == TECHNIQUE_CLUSTERED_FORWARD && outputMode == OUTPUT_LIGHT_HEATMAP));
 
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
@@ -468,36 +1481,52 @@ void renderScene()
 
 	// Update stuff
 	camera.update(deltaTime);
+	updateFrameData();
+	updateLights();
+	cullModel(model, camera.getViewProjection());
+
+	if (occlusionCulling && hiZValid && hiZModel == curModel)
+	{
+		beginPass(PASS_OCCLUSION_CULL);
+		cullOccludedMeshes();
+		endPass(PASS_OCCLUSION_CULL);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, screenFBO);
 	glViewport(0, 0, width, height);
 
-	if (technique == TECHNIQUE_FORWARD_PLUS || outputMode == OUTPUT_DEPTHMAP)
+	if (needsDepthPrepass)
 	{
 		// Depth step
 		// This produces a depthmap which we can use to clip by
 		// depth in the light culling step
+		beginPass(PASS_DEPTH);
 		glBindFramebuffer(GL_FRAMEBUFFER, depthFBO);
 
 		glClear(GL_DEPTH_BUFFER_BIT);
-		renderGeometry(depthShader);
+		renderGeometry(depthShader, false);
 
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, screenFBO);
+		endPass(PASS_DEPTH);
 	}
 	else if (needsGBuffer)
 	{
 		// Render to GBuffer
 		// This also renders to our depth texture
+		beginPass(PASS_GBUFFER);
 		glBindFramebuffer(GL_FRAMEBUFFER, gFBO);
 
 		glClearColor(CLEAR_COLOR.x, CLEAR_COLOR.y, CLEAR_COLOR.z, 1.0);
 		glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 		renderGeometry(deferredGBufferShader);
 
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, screenFBO);
+		endPass(PASS_GBUFFER);
 	}
 
 	if (outputMode == OUTPUT_DEPTHMAP)
 	{
 		// Render depth map to screen
+		beginPass(PASS_SHADING);
 		glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 
 		glActiveTexture(GL_TEXTURE0);
@@ -511,44 +1540,108 @@ void renderScene()
 
 		glBindTexture(GL_TEXTURE_2D, 0);
 		glActiveTexture(0);
+		endPass(PASS_SHADING);
 	}
 	else if (technique == TECHNIQUE_FORWARD)
 	{
 		// Render scene with no light culling, ie Forward Rendering
+		beginPass(PASS_SHADING);
 		glClearColor(CLEAR_COLOR.x, CLEAR_COLOR.y, CLEAR_COLOR.z, 1.0);
 		glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 		renderGeometry(forwardShader);
+		endPass(PASS_SHADING);
 	}
 	else
 	{
 		if (needsLightCulling)
 		{
-			// Light culling step
-			// For every light in lightBuffer, this shader checks
-			// whether it's visible in each 16x16 square of the
-			// screen by dividing the camera frustum and testing
-			// if the light is inside. Indices of lights which
-			// pass this test are placed in visibleLightBuffer
+			// Coarse light culling step
+			// Lists the lights in the view frustum, then the
+			// ones touching each 64x64 super-tile within its
+			// depth bounds
+			beginPass(PASS_COARSE_LIGHT_CULL);
+			cullLightsToFrustum();
+
 			glActiveTexture(GL_TEXTURE0);
 			glBindTexture(GL_TEXTURE_2D, depthTexture);
 
-			glUseProgram(lightCullShader.program);
-			lightCullShader.setUniform("lightCount", lightCount);
-			lightCullShader.setUniform("view", camera.getView());
-			glDispatchCompute(((width+15)/16), ((height+15)/16), 1);
-			glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+			if (superTileCulling)
+			{
+				glUseProgram(superTileCullShader.program);
+				glDispatchCompute(superTilesX, superTilesY, 1);
+				glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+			}
+			endPass(PASS_COARSE_LIGHT_CULL);
+		}
+
+		if (needsLightLists)
+		{
+			// Light culling step
+			// For every light in the tile's super-tile, or in the
+			// view frustum without super-tiles, this shader checks
+			// whether it's visible in each tile of the screen
+			// by dividing the camera frustum and testing if the
+			// light is inside. Indices of lights which pass
+			// this test are placed in visibleLightBuffer
+			beginPass(PASS_LIGHT_CULL);
+
+			resetListCounters();
+
+			Shader &cullShader = superTileCulling? lightCullSuperTileShader: lightCullShader;
+			glUseProgram(cullShader.program);
+			cullShader.setUniform("depthMaskCulling", depthMaskCulling[technique]);
+			glDispatchCompute(tilesX, tilesY, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+			captureTileStats(tilesX * tilesY, false, lightListCounterBuffer);
 
 			glBindTexture(GL_TEXTURE_2D, 0);
 			glActiveTexture(0);
+			endPass(PASS_LIGHT_CULL);
+		}
+
+		if (needsClusterCulling)
+		{
+			// Cluster light assignment step
+			// The view frustum is split into screen tiles and
+			// depth slices. For each tile, this shader finds the
+			// lights inside it and appends their indices to the
+			// list of every slice they overlap. This doesn't
+			// depend on the depth buffer, so it needs no prepass
+			beginPass(PASS_COARSE_LIGHT_CULL);
+			cullLightsToFrustum();
+			endPass(PASS_COARSE_LIGHT_CULL);
+
+			beginPass(PASS_LIGHT_CULL);
+
+			resetListCounters();
+
+			glUseProgram(clusterCullShader.program);
+			glDispatchCompute(clustersX, clustersY, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+			captureTileStats(clustersX * clustersY, true, lightListCounterBuffer);
+
+			endPass(PASS_LIGHT_CULL);
 		}
 
+		beginPass(PASS_SHADING);
+
 		if (outputMode == OUTPUT_LIGHT_HEATMAP)
 		{
 			// Render light heat map to screen
 			glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 
-			glUseProgram(screenLightHeatmapShader.program);
-			screenLightHeatmapShader.setUniform("lightCount", lightCount);
+			if (needsClusterCulling)
+			{
+				// Cluster lookup needs the depth of each pixel
+				glActiveTexture(GL_TEXTURE0);
+				glBindTexture(GL_TEXTURE_2D, depthTexture);
+
+				glUseProgram(screenClusterHeatmapShader.program);
+			}
+			else
+			{
+				glUseProgram(screenLightHeatmapShader.program);
+			}
 
 			glBindVertexArray(screenQuad.vao);
 			glDrawElements(GL_TRIANGLES, screenQuad.elements, GL_UNSIGNED_INT, 0);
@@ -562,11 +1655,19 @@ void renderScene()
 			// Render scene with light culling
 			// This shader uses the output of the culling shader
 			// to determine which lights are visible on each
-			// 16x16 square of the screen
+			// tile of the screen
 			glClearColor(CLEAR_COLOR.x, CLEAR_COLOR.y, CLEAR_COLOR.z, 1.0);
 			glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 			renderGeometry(forwardPlusShader);
 		}
+		else if (technique == TECHNIQUE_CLUSTERED_FORWARD)
+		{
+			// Render scene using the light lists of
+			// each fragment's cluster
+			glClearColor(CLEAR_COLOR.x, CLEAR_COLOR.y, CLEAR_COLOR.z, 1.0);
+			glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+			renderGeometry(forwardClusteredShader);
+		}
 		else // Deferred
 		{
 			// Render to screen using data from the GBuffer
@@ -574,23 +1675,26 @@ void renderScene()
 
 			if (outputMode == OUTPUT_GBUFFER)
 			{
-				// Render the 3 GBuffer textures side by side,
+				// Render positions, normals and albedo side by side,
 				// along with the final result
-				glUseProgram(screenAbsTextureShader.program);
+				glUseProgram(screenGBufferShader.program);
 				glBindVertexArray(screenQuad.vao);
+				glActiveTexture(GL_TEXTURE1);
+				glBindTexture(GL_TEXTURE_2D, depthTexture);
 				glActiveTexture(GL_TEXTURE0);
+				glBindTexture(GL_TEXTURE_2D, gNormalTex);
 
-				// Position texture
+				// Positions, reconstructed from depth
 				vec3 dims = model.bb.max - model.bb.min;
-				screenAbsTextureShader.setUniform("scale", 1.0f / glm::min(glm::min(dims.x, dims.y), dims.z));
+				screenGBufferShader.setUniform("showNormals", false);
+				screenGBufferShader.setUniform("scale", 1.0f / glm::min(glm::min(dims.x, dims.y), dims.z));
 				glViewport(0, height/2, width/2, height/2);
-				glBindTexture(GL_TEXTURE_2D, gPositionTex);
 				glDrawElements(GL_TRIANGLES, screenQuad.elements, GL_UNSIGNED_INT, 0);
 
-				// Normal texture
-				screenAbsTextureShader.setUniform("scale", 1.0f);
+				// Normals
+				screenGBufferShader.setUniform("showNormals", true);
+				screenGBufferShader.setUniform("scale", 1.0f);
 				glViewport(width/2, height/2, width/2, height/2);
-				glBindTexture(GL_TEXTURE_2D, gNormalTex);
 				glDrawElements(GL_TRIANGLES, screenQuad.elements, GL_UNSIGNED_INT, 0);
 
 				// Albedo texture
@@ -602,51 +1706,61 @@ void renderScene()
 				glViewport(width/2, 0, width/2, height/2);
 			}
 
-			if (technique == TECHNIQUE_DEFERRED_TILED)
+			if (technique == TECHNIQUE_DEFERRED_COMPUTE)
 			{
-				// Render to screen using the deferred shader with light culling
-				glUseProgram(deferredTiledShader.program);
-				deferredTiledShader.setUniform("lightCount", lightCount);
-				deferredTiledShader.setUniform("cameraPosition", camera.position);
+				// Cull and shade each tile in one dispatch, then
+				// copy the result to screen
+				glBindVertexArray(0);
+				shadeTiles();
 			}
-			else if (technique == TECHNIQUE_DEFERRED)
+			else
 			{
-				// Render to screen without light culling
-				glUseProgram(deferredShader.program);
-				deferredShader.setUniform("lightCount", lightCount);
-				deferredShader.setUniform("cameraPosition", camera.position);
-			}
+				if (technique == TECHNIQUE_DEFERRED_TILED)
+				{
+					// Render to screen using the deferred shader with light culling
+					glUseProgram(deferredTiledShader.program);
+				}
+				else if (technique == TECHNIQUE_DEFERRED)
+				{
+					// Render to screen without light culling
+					glUseProgram(deferredShader.program);
+				}
+				else if (technique == TECHNIQUE_CLUSTERED)
+				{
+					// Render to screen using the deferred shader with clustered light lists
+					glUseProgram(deferredClusteredShader.program);
+				}
 
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, gPositionTex);
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, gNormalTex);
-			glActiveTexture(GL_TEXTURE2);
-			glBindTexture(GL_TEXTURE_2D, gColSpecTex);
-			glActiveTexture(GL_TEXTURE3);
-			glBindTexture(GL_TEXTURE_2D, depthTexture);
+				glActiveTexture(GL_TEXTURE0);
+				glBindTexture(GL_TEXTURE_2D, gNormalTex);
+				glActiveTexture(GL_TEXTURE1);
+				glBindTexture(GL_TEXTURE_2D, gColSpecTex);
+				glActiveTexture(GL_TEXTURE2);
+				glBindTexture(GL_TEXTURE_2D, depthTexture);
 
-			if (outputMode != OUTPUT_GBUFFER) glBindVertexArray(screenQuad.vao);
-			glDrawElements(GL_TRIANGLES, screenQuad.elements, GL_UNSIGNED_INT, 0);
-			glBindVertexArray(0);
+				if (outputMode != OUTPUT_GBUFFER) glBindVertexArray(screenQuad.vao);
+				glDrawElements(GL_TRIANGLES, screenQuad.elements, GL_UNSIGNED_INT, 0);
+				glBindVertexArray(0);
 
-			glBindTexture(GL_TEXTURE_2D, 0);
-			glActiveTexture(GL_TEXTURE2);
-			glBindTexture(GL_TEXTURE_2D, 0);
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, 0);
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, 0);
+				glBindTexture(GL_TEXTURE_2D, 0);
+				glActiveTexture(GL_TEXTURE1);
+				glBindTexture(GL_TEXTURE_2D, 0);
+				glActiveTexture(GL_TEXTURE0);
+				glBindTexture(GL_TEXTURE_2D, 0);
+			}
 		}
+
+		endPass(PASS_SHADING);
 	}
 
 	if (lightSpheres)
 	{
-		if (technique != TECHNIQUE_FORWARD)
+		beginPass(PASS_LIGHT_SPHERES);
+		if (technique != TECHNIQUE_FORWARD && technique != TECHNIQUE_CLUSTERED_FORWARD)
 		{
 			// Blit depth buffer to default framebuffer
 			glBindFramebuffer(GL_READ_FRAMEBUFFER, depthFBO);
-			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, screenFBO);
 			if (outputMode == OUTPUT_GBUFFER)
 				glBlitFramebuffer(0,		0,	width,	height,
 								  width/2,	0,	width,	height/2,
@@ -657,6 +1771,17 @@ void renderScene()
 								  GL_DEPTH_BUFFER_BIT, GL_NEAREST);
 		}
 		renderLightsDebug();
+		endPass(PASS_LIGHT_SPHERES);
+	}
+
+	// Keep this frame's depth for next frame's occlusion culling.
+	// Forward and Clustered Forward don't render a depth map
+	hiZValid = false;
+	if (occlusionCulling && (needsDepthPrepass || needsGBuffer))
+	{
+		beginPass(PASS_HI_Z);
+		buildHiZ();
+		endPass(PASS_HI_Z);
 	}
 
 	// Clean up
@@ -665,7 +1790,16 @@ void renderScene()
 	glDisable(GL_CULL_FACE);
 
 	// Render HUD
-	renderHUD();
+	if (showHUD)
+	{
+		beginPass(PASS_HUD);
+		renderHUD();
+		endPass(PASS_HUD);
+	}
+
+	fenceLights();
+	endProfilerFrame();
+	updateTileTuning();
 }
 
 int SDLCALL handleInput(void *userdata, SDL_Event* event)
@@ -705,11 +1839,11 @@ int SDLCALL handleInput(void *userdata, SDL_Event* event)
 
 		case SDLK_PLUS:
 		case SDLK_EQUALS:
-			lightCount = glm::min(lightCount + 64, MAX_LIGHT_COUNT);
+			lightCount = glm::min(glm::max(lightCount * 2, 1), MAX_LIGHT_COUNT);
 			break;
 
 		case SDLK_MINUS:
-			lightCount = glm::max(lightCount - 64, 0);
+			lightCount /= 2;
 			break;
 
 		case SDLK_F1:
@@ -722,7 +1856,7 @@ int SDLCALL handleInput(void *userdata, SDL_Event* event)
 
 		case SDLK_F3:
 			outputMode = OutputMode((outputMode + 1) % OUTPUT_MODE_MAX);
-			if (technique == TECHNIQUE_FORWARD_PLUS && outputMode == OUTPUT_GBUFFER)
+			if ((technique == TECHNIQUE_FORWARD_PLUS || technique == TECHNIQUE_CLUSTERED_FORWARD) && outputMode == OUTPUT_GBUFFER)
 			{
 				outputMode = OutputMode((outputMode + 1) % OUTPUT_MODE_MAX);
 			}
@@ -754,6 +1888,58 @@ int SDLCALL handleInput(void *userdata, SDL_Event* event)
 		case SDLK_F7:
 			lightSpheres = !lightSpheres;
 			break;
+
+		case SDLK_F8:
+			if (recording)
+			{
+				saveCameraPath(recordFile, recordedPath);
+			}
+			else
+			{
+				recordedPath.samples.clear();
+				recordTime = recordedPath.timestep;
+			}
+			recording = !recording;
+			break;
+
+		case SDLK_F9:
+			occlusionCulling = !occlusionCulling;
+			break;
+
+		case SDLK_F10:
+			textureFilter = TextureFilter((textureFilter + 1) % FILTER_MAX);
+			for (Model &m: models) setTextureFilter(m, textureFilter);
+			setTextureFilter(model, textureFilter);
+			break;
+
+		case SDLK_F11:
+			gpuLightAnimation = !gpuLightAnimation;
+			break;
+
+		case SDLK_F12:
+			superTileCulling = !superTileCulling;
+			break;
+
+		case SDLK_m:
+			depthMaskCulling[technique] = !depthMaskCulling[technique];
+			break;
+
+		case SDLK_t:
+		{
+			// Next tile size, which also stops auto-tuning
+			int next = 0;
+			for (int i = 0; i < TILE_SIZE_COUNT; i++)
+			{
+				if (TileSizes[i] == tileSize) next = (i + 1) % TILE_SIZE_COUNT;
+			}
+			tileTuneStep = -1;
+			setTileSize(TileSizes[next]);
+			break;
+		}
+
+		case SDLK_u:
+			startTileTuning();
+			break;
 		}
 	}
 	else if (event->type == SDL_KEYUP)
@@ -811,24 +1997,344 @@ int SDLCALL handleInput(void *userdata, SDL_Event* event)
 	return 0;
 }
 
-int main()
+void recordCamera()
+{
+	if (!recording) return;
+
+	// Sample the camera at a fixed rate, independent of the framerate
+	recordTime += deltaTime;
+	while (recordTime >= recordedPath.timestep)
+	{
+		recordedPath.samples.push_back({camera.position, camera.pitch, camera.yaw});
+		recordTime -= recordedPath.timestep;
+	}
+}
+
+void finishFrame()
+{
+	if (!headless) SDL_GL_SwapWindow(window);
+
+	// Wait for the GPU, so that frame times cover all of the frame's work
+	glFinish();
+}
+
+void runHeadless()
+{
+	// Use a fixed timestep so that light movement, and therefore
+	// the rendered frames, are the same on every run
+	int frameLimit = headlessFrames;
+	if (frameLimit <= 0 && headlessSeconds <= 0.0) frameLimit = HEADLESS_DEFAULT_FRAMES;
+
+	deltaTime = HEADLESS_TIMESTEP;
+
+	vector<double> frameTimes;
+	double elapsed = 0.0;
+	Uint64 frequency = SDL_GetPerformanceFrequency();
+	Uint64 start = SDL_GetPerformanceCounter();
+	resetDropRate();
+
+	while ((frameLimit <= 0 || frameTimes.size() < frameLimit) &&
+		   (headlessSeconds <= 0.0 || elapsed < headlessSeconds))
+	{
+		Uint64 frameStart = SDL_GetPerformanceCounter();
+
+		renderScene();
+		finishFrame();
+
+		Uint64 now = SDL_GetPerformanceCounter();
+		frameTimes.push_back((now - frameStart) / double(frequency));
+		elapsed = (now - start) / double(frequency);
+		curTime += deltaTime;
+		framerate = frameTimes.size() / elapsed;
+	}
+
+	if (frameTimes.empty()) return;
+
+	FrameStats stats = computeFrameStats(frameTimes);
+
+	cout<<"Headless run: "<<stats.frames<<" frames in "<<elapsed<<" s"<<endl
+		<<"  Model: "<<ModelStr[curModel]<<endl
+		<<"  Technique: "<<TechniqueStr[technique]<<endl
+		<<"  Output mode: "<<OutputModeStr[outputMode]<<endl
+		<<"  Light count: "<<lightCount<<endl
+		<<"  Resolution: "<<width<<"x"<<height<<endl
+		<<"  GBuffer: "<<GBufferFormatStr[gBufferFormat]<<" normals, "<<GBUFFER_BYTES_PER_PIXEL<<" bytes per pixel"<<endl
+		<<"  Tile size: "<<tileSize<<"x"<<tileSize<<endl
+		<<"  Light list entries dropped: "<<getDropRate() * 100.0<<"%"<<endl
+		<<"  Frame time (ms): min "<<stats.min * 1000.0
+		<<", mean "<<stats.mean * 1000.0
+		<<", p99 "<<stats.p99 * 1000.0
+		<<", max "<<stats.max * 1000.0<<endl
+		<<"  Average framerate: "<<1.0 / stats.mean<<endl;
+}
+
+void runBenchmark()
+{
+	CameraPath path;
+	if (!loadCameraPath(replayFile, path)) return;
+
+	vector<BenchmarkResult> results;
+	Uint64 frequency = SDL_GetPerformanceFrequency();
+
+	outputMode = OUTPUT_RENDERED;
+	deltaTime = path.timestep;
+
+	for (unsigned int m = 0; m < models.size() && !quitting; m++)
+	{
+		curModel = m;
+		model = models[m];
+
+		for (int t = 0; t < TECHNIQUE_MAX && !quitting; t++)
+		{
+			technique = Technique(t);
+
+			// Warm up, then reset the lights so every technique
+			// sees the same light positions on the same frame
+			camera.position = path.samples[0].position;
+			camera.pitch = path.samples[0].pitch;
+			camera.yaw = path.samples[0].yaw;
+
+			for (int i = 0; i < BENCHMARK_WARMUP_FRAMES; i++)
+			{
+				renderScene();
+				finishFrame();
+			}
+
+			generateLights();
+
+			vector<double> frameTimes;
+			double triangles = 0.0;
+			double fragments = 0.0;
+			resetDropRate();
+
+			for (const CameraSample &sample: path.samples)
+			{
+				if (!headless)
+				{
+					SDL_Event event;
+					while (SDL_PollEvent(&event));
+					if (quitting) break;
+				}
+
+				camera.position = sample.position;
+				camera.pitch = sample.pitch;
+				camera.yaw = sample.yaw;
+
+				Uint64 start = SDL_GetPerformanceCounter();
+
+				renderScene();
+				finishFrame();
+
+				frameTimes.push_back((SDL_GetPerformanceCounter() - start) / double(frequency));
+				framerate = 1.0 / frameTimes.back();
+
+				triangles += getTrianglesDrawn();
+				fragments += getFragmentsDrawn();
+			}
+
+			BenchmarkResult result;
+			result.model = ModelStr[m];
+			result.technique = TechniqueStr[t];
+			result.lightCount = lightCount;
+			result.occlusionCulling = occlusionCulling;
+			result.stats = computeFrameStats(frameTimes);
+			result.triangles = triangles / glm::max(frameTimes.size(), size_t(1));
+			result.fragments = fragments / glm::max(frameTimes.size(), size_t(1));
+			result.dropRate = getDropRate();
+			results.push_back(result);
+
+			cout<<result.model<<" - "<<result.technique<<": mean "<<result.stats.mean * 1000.0
+				<<" ms, p95 "<<result.stats.p95 * 1000.0
+				<<" ms, p99 "<<result.stats.p99 * 1000.0<<" ms, "
+				<<result.triangles<<" triangles, "<<result.fragments<<" fragments, "
+				<<result.dropRate * 100.0<<"% light list entries dropped"<<endl;
+		}
+	}
+
+	writeBenchmarkReport(reportFile, results);
+}
+
+bool parseArguments(int argc, char **argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool hasValue = (i + 1 < argc);
+
+		if (arg == "--headless")
+		{
+			headless = true;
+		}
+		else if (arg == "--frames" && hasValue)
+		{
+			headlessFrames = atoi(argv[++i]);
+		}
+		else if (arg == "--seconds" && hasValue)
+		{
+			headlessSeconds = atof(argv[++i]);
+		}
+		else if (arg == "--technique" && hasValue)
+		{
+			technique = Technique(glm::clamp(atoi(argv[++i]), 0, TECHNIQUE_MAX - 1));
+		}
+		else if (arg == "--model" && hasValue)
+		{
+			curModel = glm::clamp(atoi(argv[++i]), 0, int(sizeof(ModelStr) / sizeof(ModelStr[0])) - 1);
+		}
+		else if (arg == "--lights" && hasValue)
+		{
+			lightCount = glm::clamp(atoi(argv[++i]), 0, MAX_LIGHT_COUNT);
+		}
+		else if (arg == "--record" && hasValue)
+		{
+			recordFile = argv[++i];
+		}
+		else if (arg == "--replay" && hasValue)
+		{
+			replayFile = argv[++i];
+		}
+		else if (arg == "--report" && hasValue)
+		{
+			reportFile = argv[++i];
+		}
+		else if (arg == "--gpu-log" && hasValue)
+		{
+			gpuLogFile = argv[++i];
+		}
+		else if (arg == "--tile-stats-log" && hasValue)
+		{
+			tileStatsLogFile = argv[++i];
+		}
+		else if (arg == "--no-occlusion-culling")
+		{
+			occlusionCulling = false;
+		}
+		else if (arg == "--texture-filter" && hasValue)
+		{
+			textureFilter = TextureFilter(glm::clamp(atoi(argv[++i]), 0, FILTER_MAX - 1));
+		}
+		else if (arg == "--gbuffer-format" && hasValue)
+		{
+			gBufferFormat = GBufferFormat(glm::clamp(atoi(argv[++i]), 0, GBUFFER_FORMAT_MAX - 1));
+		}
+		else if (arg == "--gpu-light-animation")
+		{
+			gpuLightAnimation = true;
+		}
+		else if (arg == "--no-super-tiles")
+		{
+			superTileCulling = false;
+		}
+		else if (arg == "--depth-mask")
+		{
+			for (int t = 0; t < TECHNIQUE_MAX; t++) depthMaskCulling[t] = true;
+		}
+		else if (arg == "--tile-size" && hasValue)
+		{
+			tileSize = atoi(argv[++i]);
+			bool valid = false;
+			for (int t = 0; t < TILE_SIZE_COUNT; t++) valid = valid || (TileSizes[t] == tileSize);
+			if (!valid)
+			{
+				cerr<<"Tile size must be 8, 16 or 32"<<endl;
+				return false;
+			}
+		}
+		else if (arg == "--auto-tune-tiles")
+		{
+			autoTuneTiles = true;
+		}
+		else if (arg == "--no-shader-cache")
+		{
+			setShaderCache(false);
+		}
+		else
+		{
+			cerr<<"Usage: "<<argv[0]<<" [options]"<<endl
+				<<"  --headless         Render offscreen without a window, then print a summary"<<endl
+				<<"  --frames <n>       Number of frames to render in headless mode"<<endl
+				<<"  --seconds <s>      Number of seconds to render in headless mode"<<endl
+				<<"  --technique <n>    Initial rendering technique"<<endl
+				<<"  --model <n>        Initial model"<<endl
+				<<"  --lights <n>       Initial light count, up to "<<MAX_LIGHT_COUNT<<endl
+				<<"  --record <file>    File to save camera paths to when recording with F8"<<endl
+				<<"  --replay <file>    Replay a camera path with every model and technique, then exit"<<endl
+				<<"  --report <file>    CSV file for replay frame time statistics"<<endl
+				<<"  --gpu-log <file>   CSV file for per-frame GPU pass timings"<<endl
+				<<"  --tile-stats-log <file> CSV file for per-frame tile light counts"<<endl
+				<<"  --no-occlusion-culling  Draw meshes hidden behind others"<<endl
+				<<"  --texture-filter <n>    0 bilinear without mipmaps, 1 trilinear, 2 anisotropic"<<endl
+				<<"  --no-shader-cache       Compile every shader instead of loading saved binaries"<<endl
+				<<"  --gbuffer-format <n>    GBuffer normals as 0 RG16, 1 RGB10A2"<<endl
+				<<"  --gpu-light-animation   Move the lights in a compute shader"<<endl
+				<<"  --no-super-tiles        Cull lights per tile without the super-tile pass"<<endl
+				<<"  --depth-mask            Start with depth mask light culling on for every technique"<<endl
+				<<"  --tile-size <n>         Light culling tile size, 8, 16 or 32 pixels"<<endl
+				<<"  --auto-tune-tiles       Time each tile size at startup and keep the fastest"<<endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int main(int argc, char **argv)
 {
-	if (SDL_Init(SDL_INIT_VIDEO|SDL_INIT_EVENTS) != 0)
+	if (!parseArguments(argc, argv))
+	{
+		return 1;
+	}
+
+	if (headless)
 	{
-		SDL_Log("Failed to initialize SDL: %s", SDL_GetError());
-		return 0;
+		if (!createHeadlessContext(4, 3))
+		{
+			return 1;
+		}
+	}
+	else
+	{
+		if (SDL_Init(SDL_INIT_VIDEO|SDL_INIT_EVENTS) != 0)
+		{
+			SDL_Log("Failed to initialize SDL: %s", SDL_GetError());
+			return 0;
+		}
+
+		window = SDL_CreateWindow(title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, width, height, SDL_WINDOW_OPENGL);
+
+		glContext = SDL_GL_CreateContext(window);
+		SDL_GL_SetSwapInterval(0);
+
+		SDL_SetWindowFullscreen(window, fullScreen? SDL_WINDOW_FULLSCREEN: 0);
 	}
 
-	window = SDL_CreateWindow(title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, width, height, SDL_WINDOW_OPENGL);
+	GLenum glewStatus = glewInit();
 
-	glContext = SDL_GL_CreateContext(window);
-	SDL_GL_SetSwapInterval(0);
+	// GLEW built for GLX still loads the GL functions without an X
+	// display, which a headless EGL context doesn't need
+	bool glewFailed = glewStatus != GLEW_OK;
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+	if (headless && glewStatus == GLEW_ERROR_NO_GLX_DISPLAY) glewFailed = false;
+#endif
 
-	SDL_SetWindowFullscreen(window, fullScreen? SDL_WINDOW_FULLSCREEN: 0);
+	if (glewFailed)
+	{
+		cerr<<"Failed to initialize GLEW: "<<glewGetErrorString(glewStatus)<<endl;
 
-	glewInit();
+		if (headless)
+		{
+			destroyHeadlessContext();
+		}
+		else
+		{
+			SDL_GL_DeleteContext(glContext);
+			SDL_DestroyWindow(window);
+			SDL_Quit();
+		}
+		return 1;
+	}
 
-	SDL_AddEventWatch(handleInput, NULL);
+	if (!headless) SDL_AddEventWatch(handleInput, NULL);
 
 	const GLubyte *version = glGetString(GL_VERSION),
 				*vendor = glGetString(GL_VENDOR),
@@ -839,6 +2345,18 @@ int main()
 		<<"Renderer: "<<renderer<<endl<<endl;
 
 	initialize();
+	if (autoTuneTiles) startTileTuning();
+
+	if (!replayFile.empty())
+	{
+		runBenchmark();
+		quitting = true;
+	}
+	else if (headless)
+	{
+		runHeadless();
+		quitting = true;
+	}
 
 	while(!quitting)
 	{
@@ -869,19 +2387,32 @@ int main()
 		}
 
 		renderScene();
+		recordCamera();
 		SDL_GL_SwapWindow(window);
 		SDL_Delay(2);
 	}
 
+	if (recording)
+	{
+		saveCameraPath(recordFile, recordedPath);
+	}
+
 	deinitialize();
 	clearMeshes();
 	clearTextures();
 	clearShaders();
 
-	SDL_DelEventWatch(handleInput, NULL);
-	SDL_GL_DeleteContext(glContext);
-	SDL_DestroyWindow(window);
-	SDL_Quit();
+	if (headless)
+	{
+		destroyHeadlessContext();
+	}
+	else
+	{
+		SDL_DelEventWatch(handleInput, NULL);
+		SDL_GL_DeleteContext(glContext);
+		SDL_DestroyWindow(window);
+		SDL_Quit();
+	}
 
 	return 0;
 }
@@ -31,6 +31,7 @@ using std::shared_ptr;
 using glm::vec2;
 using glm::vec3;
 using glm::vec4;
+using glm::ivec3;
 using glm::quat;
 using glm::mat3;
 using glm::mat4;
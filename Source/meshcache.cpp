@@ -0,0 +1,334 @@
+#include "meshcache.h"
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Bump when the file layout or Vertex changes
+const uint32_t MESH_CACHE_VERSION = 1;
+const char MESH_CACHE_MAGIC[8] = {'R', 'D', 'M', 'E', 'S', 'H', '\0', '\0'};
+
+// File layout: header, vertices, indices, mesh records, then the
+// material records with their texture paths. Blobs start at 16 byte
+// aligned offsets so they can be used in place
+struct CacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t vertexSize;
+	uint64_t sourceHash;
+	uint64_t vertexOffset;
+	uint64_t vertexCount;
+	uint64_t indexOffset;
+	uint64_t indexCount;
+	uint64_t meshOffset;
+	uint64_t meshCount;
+	uint64_t materialOffset;
+	uint64_t materialCount;
+	uint64_t fileSize;
+};
+
+struct CacheMesh
+{
+	uint32_t firstIndex;
+	int32_t baseVertex;
+	uint32_t elements;
+	uint32_t materialIndex;
+	float transform[16];
+	float bbMin[3];
+	float bbMax[3];
+};
+
+uint64_t hashFile(const string &filename, uint64_t hash)
+{
+	std::ifstream file(filename.c_str(), std::ios::binary);
+	if (!file.is_open()) return 0;
+
+	// 64 bit FNV-1a
+	char data[65536];
+
+	while (file)
+	{
+		file.read(data, sizeof(data));
+		for (std::streamsize i = 0; i < file.gcount(); i++)
+		{
+			hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+		}
+	}
+
+	return hash;
+}
+
+uint64_t alignOffset(uint64_t offset)
+{
+	return (offset + 15) & ~uint64_t(15);
+}
+
+// Whether count items of the given size, starting at offset, lie
+// inside a file of fileSize bytes. Written so nothing can overflow
+bool rangeInFile(uint64_t offset, uint64_t count, uint64_t size, uint64_t fileSize)
+{
+	return offset <= fileSize && count <= (fileSize - offset) / size;
+}
+
+// Checks every offset and count read from the file, so a truncated or
+// corrupt cache is rejected instead of read past its end. The indices
+// themselves were checked once in writeMeshCache, and aren't walked
+// again on every load
+bool parseMeshCache(const CacheHeader *header, MeshCache &cache)
+{
+	const char *data = (const char*)cache.mapping;
+	uint64_t fileSize = cache.mappingSize;
+
+	if (alignOffset(header->vertexOffset) != header->vertexOffset ||
+		alignOffset(header->indexOffset) != header->indexOffset ||
+		alignOffset(header->meshOffset) != header->meshOffset ||
+		!rangeInFile(header->vertexOffset, header->vertexCount, sizeof(Vertex), fileSize) ||
+		!rangeInFile(header->indexOffset, header->indexCount, sizeof(GLuint), fileSize) ||
+		!rangeInFile(header->meshOffset, header->meshCount, sizeof(CacheMesh), fileSize) ||
+		header->materialOffset > fileSize)
+	{
+		return false;
+	}
+
+	cache.vertices = (const Vertex*)(data + header->vertexOffset);
+	cache.vertexCount = header->vertexCount;
+	cache.indices = (const GLuint*)(data + header->indexOffset);
+	cache.indexCount = header->indexCount;
+
+	const CacheMesh *meshes = (const CacheMesh*)(data + header->meshOffset);
+	for (uint64_t i = 0; i < header->meshCount; i++)
+	{
+		const CacheMesh &mesh = meshes[i];
+		if (uint64_t(mesh.firstIndex) + mesh.elements > cache.indexCount ||
+			mesh.baseVertex < 0 || uint64_t(mesh.baseVertex) > cache.vertexCount ||
+			mesh.materialIndex >= header->materialCount)
+		{
+			return false;
+		}
+
+		Mesh m;
+		m.firstIndex = mesh.firstIndex;
+		m.baseVertex = mesh.baseVertex;
+		m.elements = mesh.elements;
+		m.materialIndex = mesh.materialIndex;
+		m.transform = glm::make_mat4(mesh.transform);
+		m.bb.min = glm::make_vec3(mesh.bbMin);
+		m.bb.max = glm::make_vec3(mesh.bbMax);
+		cache.meshes.push_back(m);
+	}
+
+	// Materials: texture count, then type, path length and path of each texture
+	uint64_t offset = header->materialOffset;
+	for (uint64_t i = 0; i < header->materialCount; i++)
+	{
+		CachedMaterial material;
+		uint32_t textureCount;
+		if (!rangeInFile(offset, 1, sizeof(uint32_t), fileSize)) return false;
+		memcpy(&textureCount, data + offset, sizeof(uint32_t));
+		offset += sizeof(uint32_t);
+
+		for (uint32_t j = 0; j < textureCount; j++)
+		{
+			uint32_t type, length;
+			if (!rangeInFile(offset, 2, sizeof(uint32_t), fileSize)) return false;
+			memcpy(&type, data + offset, sizeof(uint32_t));
+			memcpy(&length, data + offset + sizeof(uint32_t), sizeof(uint32_t));
+			offset += 2 * sizeof(uint32_t);
+
+			if (!rangeInFile(offset, length, 1, fileSize)) return false;
+			material.textureTypes.push_back(aiTextureType(type));
+			material.texturePaths.push_back(string(data + offset, length));
+			offset += length;
+		}
+
+		cache.materials.push_back(material);
+	}
+
+	return true;
+}
+
+bool mapFile(const string &filename, MeshCache &cache)
+{
+#ifdef USE_MMAP
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (mapping == MAP_FAILED) return false;
+
+	cache.mapping = mapping;
+	cache.mappingSize = st.st_size;
+#else
+	std::ifstream file(filename.c_str(), std::ios::binary | std::ios::ate);
+	if (!file.is_open()) return false;
+
+	cache.buffer.resize(file.tellg());
+	file.seekg(0);
+	file.read(&cache.buffer[0], cache.buffer.size());
+
+	cache.mapping = &cache.buffer[0];
+	cache.mappingSize = cache.buffer.size();
+#endif
+	return true;
+}
+
+bool openMeshCache(const string &filename, uint64_t sourceHash, MeshCache &cache)
+{
+	if (!mapFile(filename, cache)) return false;
+
+	const char *data = (const char*)cache.mapping;
+	const CacheHeader *header = (const CacheHeader*)data;
+
+	if (cache.mappingSize < sizeof(CacheHeader) ||
+		memcmp(header->magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC)) != 0 ||
+		header->version != MESH_CACHE_VERSION ||
+		header->vertexSize != sizeof(Vertex) ||
+		header->fileSize != cache.mappingSize)
+	{
+		cerr<<"Ignoring outdated mesh cache '"<<filename<<"'."<<endl;
+		closeMeshCache(cache);
+		return false;
+	}
+
+	if (header->sourceHash != sourceHash)
+	{
+		closeMeshCache(cache);
+		return false;
+	}
+
+	if (!parseMeshCache(header, cache))
+	{
+		cerr<<"Ignoring corrupt mesh cache '"<<filename<<"'."<<endl;
+		closeMeshCache(cache);
+		return false;
+	}
+
+	return true;
+}
+
+void closeMeshCache(MeshCache &cache)
+{
+#ifdef USE_MMAP
+	if (cache.mapping) munmap(cache.mapping, cache.mappingSize);
+#endif
+	cache.buffer.clear();
+	cache.mapping = nullptr;
+	cache.mappingSize = 0;
+	cache.vertices = nullptr;
+	cache.vertexCount = 0;
+	cache.indices = nullptr;
+	cache.indexCount = 0;
+	cache.meshes.clear();
+	cache.materials.clear();
+}
+
+bool writeMeshCache(const string &filename, uint64_t sourceHash, const Model &model,
+					const vector<Vertex> &vertices, const vector<GLuint> &indices)
+{
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC));
+	header.version = MESH_CACHE_VERSION;
+	header.vertexSize = sizeof(Vertex);
+	header.sourceHash = sourceHash;
+
+	vector<CacheMesh> meshes;
+	for (const Mesh &mesh: model.meshes)
+	{
+		// Every vertex the mesh draws must be in the vertex blob. Loads
+		// only check the ranges, so a bad index is never cached
+		for (GLuint i = 0; i < mesh.elements; i++)
+		{
+			if (uint64_t(indices[mesh.firstIndex + i]) + mesh.baseVertex >= vertices.size())
+			{
+				cerr<<"Not writing mesh cache '"<<filename<<"', a mesh indexes past its vertices."<<endl;
+				return false;
+			}
+		}
+
+		CacheMesh m;
+		m.firstIndex = mesh.firstIndex;
+		m.baseVertex = mesh.baseVertex;
+		m.elements = mesh.elements;
+		m.materialIndex = mesh.materialIndex;
+		memcpy(m.transform, glm::value_ptr(mesh.transform), sizeof(m.transform));
+		memcpy(m.bbMin, glm::value_ptr(mesh.bb.min), sizeof(m.bbMin));
+		memcpy(m.bbMax, glm::value_ptr(mesh.bb.max), sizeof(m.bbMax));
+		meshes.push_back(m);
+	}
+
+	string materials;
+	for (const Material &material: model.materials)
+	{
+		uint32_t textureCount = material.texturePaths.size();
+		materials.append((const char*)&textureCount, sizeof(uint32_t));
+
+		for (uint32_t i = 0; i < textureCount; i++)
+		{
+			uint32_t type = material.textureTypes[i];
+			uint32_t length = material.texturePaths[i].size();
+			materials.append((const char*)&type, sizeof(uint32_t));
+			materials.append((const char*)&length, sizeof(uint32_t));
+			materials.append(material.texturePaths[i]);
+		}
+	}
+
+	header.vertexOffset = alignOffset(sizeof(CacheHeader));
+	header.vertexCount = vertices.size();
+	header.indexOffset = alignOffset(header.vertexOffset + vertices.size() * sizeof(Vertex));
+	header.indexCount = indices.size();
+	header.meshOffset = alignOffset(header.indexOffset + indices.size() * sizeof(GLuint));
+	header.meshCount = meshes.size();
+	header.materialOffset = alignOffset(header.meshOffset + meshes.size() * sizeof(CacheMesh));
+	header.materialCount = model.materials.size();
+	header.fileSize = header.materialOffset + materials.size();
+
+	// Write to a temporary file first, so an interrupted write
+	// never leaves a cache that looks valid
+	string tempFilename = filename + ".tmp";
+	std::ofstream file(tempFilename.c_str(), std::ios::binary);
+
+	if (!file.is_open())
+	{
+		cerr<<"Failed to write mesh cache '"<<filename<<"'."<<endl;
+		return false;
+	}
+
+	auto writeAt = [&](uint64_t offset, const void *data, size_t size)
+	{
+		static const char padding[16] = {0};
+		file.write(padding, offset - file.tellp());
+		file.write((const char*)data, size);
+	};
+
+	writeAt(0, &header, sizeof(header));
+	writeAt(header.vertexOffset, vertices.data(), vertices.size() * sizeof(Vertex));
+	writeAt(header.indexOffset, indices.data(), indices.size() * sizeof(GLuint));
+	writeAt(header.meshOffset, meshes.data(), meshes.size() * sizeof(CacheMesh));
+	writeAt(header.materialOffset, materials.data(), materials.size());
+	file.close();
+
+	if (!file || std::rename(tempFilename.c_str(), filename.c_str()) != 0)
+	{
+		cerr<<"Failed to write mesh cache '"<<filename<<"'."<<endl;
+		std::remove(tempFilename.c_str());
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,38 @@
+#ifndef _MESHCACHE_H_INCLUDED_
+#define _MESHCACHE_H_INCLUDED_
+
+#include "main.h"
+#include "model.h"
+#include <cstdint>
+
+struct CachedMaterial
+{
+	vector<string> texturePaths;
+	vector<aiTextureType> textureTypes;
+};
+
+// A cache file mapped into memory. vertices and indices point into
+// the mapping and stay valid until the cache is closed
+struct MeshCache
+{
+	void *mapping = nullptr;
+	size_t mappingSize = 0;
+	vector<char> buffer;
+
+	const Vertex *vertices = nullptr;
+	size_t vertexCount = 0;
+	const GLuint *indices = nullptr;
+	size_t indexCount = 0;
+
+	vector<Mesh> meshes;
+	vector<CachedMaterial> materials;
+};
+
+// Folds the file's contents into hash, 0 if it can't be read
+uint64_t hashFile(const string &filename, uint64_t hash = 14695981039346656037ULL);
+bool openMeshCache(const string &filename, uint64_t sourceHash, MeshCache &cache);
+void closeMeshCache(MeshCache &cache);
+bool writeMeshCache(const string &filename, uint64_t sourceHash, const Model &model,
+					const vector<Vertex> &vertices, const vector<GLuint> &indices);
+
+#endif // _MESHCACHE_H_INCLUDED_
@@ -1,26 +1,11 @@
 #include "model.h"
+#include "meshcache.h"
 
 vector<Mesh> meshes;
+vector<Model> loadedModels;
 
-Mesh createMesh(vector<Vertex> vertices, vector<GLuint> indices, mat4 transform, Material material, BoundingBox bb)
+void setVertexAttributes()
 {
-	Mesh m;
-	m.elements = indices.size();
-	m.transform = transform;
-	m.material = material;
-	m.bb = bb;
-
-	glGenVertexArrays(1, &m.vao);
-	glGenBuffers(1, &m.vbo);
-	glGenBuffers(1, &m.ebo);
-
-	glBindVertexArray(m.vao);
-	glBindBuffer(GL_ARRAY_BUFFER, m.vbo);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
-
 	// Vertex Positions
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
@@ -40,6 +25,27 @@ Mesh createMesh(vector<Vertex> vertices, vector<GLuint> indices, mat4 transform,
 	// Vertex Bitangents
 	glEnableVertexAttribArray(4);
 	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, bitangent));
+}
+
+Mesh createMesh(vector<Vertex> vertices, vector<GLuint> indices, mat4 transform, BoundingBox bb)
+{
+	Mesh m;
+	m.elements = indices.size();
+	m.transform = transform;
+	m.bb = bb;
+
+	glGenVertexArrays(1, &m.vao);
+	glGenBuffers(1, &m.vbo);
+	glGenBuffers(1, &m.ebo);
+
+	glBindVertexArray(m.vao);
+	glBindBuffer(GL_ARRAY_BUFFER, m.vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+
+	setVertexAttributes();
 
 	glBindVertexArray(0);
 
@@ -47,6 +53,102 @@ Mesh createMesh(vector<Vertex> vertices, vector<GLuint> indices, mat4 transform,
 	return m;
 }
 
+void createModelBuffers(Model &model, const Vertex *vertices, size_t vertexCount, const GLuint *indices, size_t indexCount)
+{
+	vector<MeshData> meshData;
+	vector<GLuint> meshIndices;
+
+	// Meshes are sorted by material, so every material is one range of commands
+	for (unsigned int i = 0; i < model.meshes.size(); i++)
+	{
+		const Mesh &mesh = model.meshes[i];
+
+		DrawCommand command;
+		command.count = mesh.elements;
+		command.instanceCount = 1;
+		command.firstIndex = mesh.firstIndex;
+		command.baseVertex = mesh.baseVertex;
+		command.baseInstance = i;
+		model.commands.push_back(command);
+
+		MeshData data;
+		data.transform = mesh.transform;
+		data.materialIndex = mesh.materialIndex;
+		data.boxMin = vec4(mesh.worldBB.min, 1.0);
+		data.boxMax = vec4(mesh.worldBB.max, 1.0);
+		meshData.push_back(data);
+		meshIndices.push_back(i);
+
+		if (model.groups.empty() || model.groups.back().materialIndex != mesh.materialIndex)
+		{
+			model.groups.push_back({mesh.materialIndex, (int)i, 0, (int)i, 0});
+		}
+		model.groups.back().commandCount++;
+		model.groups.back().visibleCount++;
+	}
+
+	// Everything is visible until the model is first culled
+	model.visibleCommands = model.commands;
+	model.visible.assign(model.meshes.size(), 1);
+	model.visibleMeshes = model.meshes.size();
+
+	glGenVertexArrays(1, &model.vao);
+	glGenBuffers(1, &model.vbo);
+	glGenBuffers(1, &model.ebo);
+	glGenBuffers(1, &model.meshIndexBuffer);
+	glGenBuffers(1, &model.meshBuffer);
+	glGenBuffers(1, &model.indirectBuffer);
+
+	glBindVertexArray(model.vao);
+	glBindBuffer(GL_ARRAY_BUFFER, model.vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertices, GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model.ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(GLuint), indices, GL_STATIC_DRAW);
+
+	setVertexAttributes();
+
+	// Mesh index, one per instance. Every draw command starts
+	// at its own baseInstance, so this gives the index of the
+	// mesh being drawn
+	glBindBuffer(GL_ARRAY_BUFFER, model.meshIndexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, meshIndices.size() * sizeof(GLuint), &meshIndices[0], GL_STATIC_DRAW);
+	glEnableVertexAttribArray(5);
+	glVertexAttribIPointer(5, 1, GL_UNSIGNED_INT, sizeof(GLuint), (GLvoid*)0);
+	glVertexAttribDivisor(5, 1);
+
+	glBindVertexArray(0);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, model.meshBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, meshData.size() * sizeof(MeshData), &meshData[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, model.indirectBuffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, model.commands.size() * sizeof(DrawCommand), &model.commands[0], GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	loadedModels.push_back(model);
+}
+
+BoundingBox transformBoundingBox(const BoundingBox &bb, const mat4 &transform)
+{
+	// Transform all eight corners, the min and max corners
+	// alone don't bound the box once it is rotated
+	BoundingBox result;
+	for (int i = 0; i < 8; i++)
+	{
+		vec3 corner = vec3((i & 1)? bb.max.x: bb.min.x,
+						   (i & 2)? bb.max.y: bb.min.y,
+						   (i & 4)? bb.max.z: bb.min.z);
+		vec3 p = vec3(transform * vec4(corner, 1.0));
+
+		result.min = glm::min(result.min, p);
+		result.max = glm::max(result.max, p);
+	}
+
+	return result;
+}
+
 void processTextures(const string &filepath, aiTextureType type, aiMaterial *material, Material &m)
 {
 	int nTextures = material->GetTextureCount(type);
@@ -56,9 +158,40 @@ void processTextures(const string &filepath, aiTextureType type, aiMaterial *mat
 		aiString str;
 		material->GetTexture(type, i, &str);
 
-		m.textures.push_back(getTexture(filepath+str.C_Str()));
+		// Only diffuse maps hold colors
+		m.textures.push_back(getTexture(filepath+str.C_Str(), type == aiTextureType_DIFFUSE));
 		m.textureTypes.push_back(type);
+		m.texturePaths.push_back(filepath+str.C_Str());
+	}
+}
+
+void setMaterialSlots(Material &m)
+{
+	// The first texture of each type is bound to its type's sampler.
+	// Height maps are used as normal maps
+	int counters[aiTextureType_UNKNOWN] = {0};
+	m.textureSlots.clear();
+
+	for (unsigned int i = 0; i < m.textures.size(); i++)
+	{
+		int slot = -1;
+		if (++counters[m.textureTypes[i]] == 1)
+		{
+			switch (m.textureTypes[i])
+			{
+			case aiTextureType_DIFFUSE: slot = SLOT_DIFFUSE; break;
+			case aiTextureType_SPECULAR: slot = SLOT_SPECULAR; break;
+			case aiTextureType_HEIGHT:
+			case aiTextureType_NORMALS: slot = SLOT_NORMAL; break;
+			default: break;
+			}
+		}
+		m.textureSlots.push_back(slot);
 	}
+
+	m.missingSlots[SLOT_DIFFUSE] = (counters[aiTextureType_DIFFUSE] == 0);
+	m.missingSlots[SLOT_SPECULAR] = (counters[aiTextureType_SPECULAR] == 0);
+	m.missingSlots[SLOT_NORMAL] = (counters[aiTextureType_HEIGHT] == 0);
 }
 
 Material processMaterial(const string &filepath, aiMaterial *material)
@@ -75,13 +208,16 @@ Material processMaterial(const string &filepath, aiMaterial *material)
 //	processTextures(filepath, aiTextureType_OPACITY, material, m);
 	processTextures(filepath, aiTextureType_DISPLACEMENT, material, m);
 
+	setMaterialSlots(m);
 	return m;
 }
 
-Mesh processMesh(const string &filepath, aiMesh *mesh, const aiScene *scene, const mat4 &transform)
+Mesh processMesh(aiMesh *mesh, const mat4 &transform, vector<Vertex> &vertices, vector<GLuint> &indices)
 {
-	vector<Vertex> vertices;
-	vector<GLuint> indices;
+	Mesh m;
+	m.firstIndex = indices.size();
+	m.baseVertex = vertices.size();
+	m.transform = transform;
 	BoundingBox bb;
 
 	for(GLuint i = 0; i < mesh->mNumVertices; i++)
@@ -123,27 +259,105 @@ Mesh processMesh(const string &filepath, aiMesh *mesh, const aiScene *scene, con
 			indices.push_back(face.mIndices[j]);
 	}
 
-	// Process material
-	Material material = processMaterial(filepath, scene->mMaterials[mesh->mMaterialIndex]);
+	m.elements = indices.size() - m.firstIndex;
+	m.bb = bb;
 
-	return createMesh(vertices, indices, transform, material, bb);
+	return m;
 }
 
-void processNode(const string &filepath, aiNode *node, const aiScene *scene, const mat4 &transform, Model &model)
+void processNode(const string &filepath, aiNode *node, const aiScene *scene, const mat4 &transform, Model &model,
+				 vector<Vertex> &vertices, vector<GLuint> &indices, vector<int> &materialMap)
 {
 	mat4 nodeTransform = transform * glm::transpose(glm::make_mat4(&node->mTransformation.a1));
 
 	for(GLuint i = 0; i < node->mNumMeshes; i++)
 	{
 		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-		Mesh m = processMesh(filepath, mesh, scene, nodeTransform);
+		Mesh m = processMesh(mesh, nodeTransform, vertices, indices);
+
+		// Process material, once per material used by the model
+		int &materialIndex = materialMap[mesh->mMaterialIndex];
+		if (materialIndex < 0)
+		{
+			materialIndex = model.materials.size();
+			model.materials.push_back(processMaterial(filepath, scene->mMaterials[mesh->mMaterialIndex]));
+		}
+		m.materialIndex = materialIndex;
+
 		model.meshes.push_back(m);
 	}
 
 	for(GLuint i = 0; i < node->mNumChildren; i++)
 	{
-		processNode(filepath, node->mChildren[i], scene, nodeTransform, model);
+		processNode(filepath, node->mChildren[i], scene, nodeTransform, model, vertices, indices, materialMap);
+	}
+}
+
+void computeBounds(Model &model)
+{
+	for (Mesh &mesh: model.meshes)
+	{
+		mesh.worldBB = transformBoundingBox(mesh.bb, mesh.transform);
+		addBox(model.boxes, mesh.worldBB.min, mesh.worldBB.max);
+
+		model.bb.min = glm::min(model.bb.min, mesh.worldBB.min);
+		model.bb.max = glm::max(model.bb.max, mesh.worldBB.max);
+	}
+}
+
+bool loadCachedModel(const string &cacheFilename, uint64_t sourceHash, Model &m)
+{
+	MeshCache cache;
+	if (!openMeshCache(cacheFilename, sourceHash, cache)) return false;
+
+	m.meshes = cache.meshes;
+
+	for (const CachedMaterial &cached: cache.materials)
+	{
+		Material material;
+		for (unsigned int i = 0; i < cached.texturePaths.size(); i++)
+		{
+			material.textures.push_back(getTexture(cached.texturePaths[i], cached.textureTypes[i] == aiTextureType_DIFFUSE));
+			material.textureTypes.push_back(cached.textureTypes[i]);
+			material.texturePaths.push_back(cached.texturePaths[i]);
+		}
+		setMaterialSlots(material);
+		m.materials.push_back(material);
 	}
+
+	computeBounds(m);
+
+	// Vertices and indices go from the mapped file to GL as they are
+	createModelBuffers(m, cache.vertices, cache.vertexCount, cache.indices, cache.indexCount);
+	closeMeshCache(cache);
+
+	return true;
+}
+
+// Hash of the model file and, for .obj files, the material libraries
+// it names, which hold the texture paths stored in the cache
+uint64_t hashModelSources(const string &filename, const string &filepath)
+{
+	uint64_t hash = hashFile(filename);
+	if (hash == 0 || filename.size() < 4 || filename.compare(filename.size() - 4, 4, ".obj") != 0) return hash;
+
+	std::ifstream file(filename.c_str());
+	string line;
+	while (std::getline(file, line))
+	{
+		if (line.compare(0, 7, "mtllib ") != 0) continue;
+
+		// The rest of the line is one file name, like assimp reads it
+		size_t first = line.find_first_not_of(" \t", 7);
+		size_t last = line.find_last_not_of(" \t\r");
+		if (first == string::npos) continue;
+
+		// Adding or removing a library changes the hash as well
+		uint64_t libraryHash = hashFile(filepath + line.substr(first, last - first + 1), hash);
+		if (libraryHash != 0) hash = libraryHash;
+	}
+
+	return hash;
 }
 
 Model loadModel(const string &filename)
@@ -156,6 +370,16 @@ Model loadModel(const string &filename)
 		filepath += filename.substr(0, separator+1);
 	}
 
+	// The processed model is cached next to the source file, and
+	// used for as long as the source file doesn't change
+	string cacheFilename = filename + ".cache";
+	uint64_t sourceHash = hashModelSources(filename, filepath);
+
+	if (sourceHash != 0 && loadCachedModel(cacheFilename, sourceHash, m))
+	{
+		return m;
+	}
+
 	Assimp::Importer import;
 	const aiScene* scene = import.ReadFile(filename, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenNormals | aiProcess_CalcTangentSpace);
 
@@ -165,20 +389,28 @@ Model loadModel(const string &filename)
 		return m;
 	}
 
-	processNode(filepath, scene->mRootNode, scene, mat4(1.0), m);
+	vector<Vertex> vertices;
+	vector<GLuint> indices;
+	vector<int> materialMap(scene->mNumMaterials, -1);
 
-	for (const Mesh &mesh: m.meshes)
+	processNode(filepath, scene->mRootNode, scene, mat4(1.0), m, vertices, indices, materialMap);
+
+	if (m.meshes.empty())
 	{
-		vec3 min = vec3(mesh.transform * vec4(mesh.bb.min, 1.0));
-		vec3 max = vec3(mesh.transform * vec4(mesh.bb.max, 1.0));
+		return m;
+	}
+
+	std::stable_sort(m.meshes.begin(), m.meshes.end(), [](const Mesh &a, const Mesh &b)
+	{
+		return a.materialIndex < b.materialIndex;
+	});
 
-		m.bb.min.x = glm::min(m.bb.min.x, min.x);
-		m.bb.min.y = glm::min(m.bb.min.y, min.y);
-		m.bb.min.z = glm::min(m.bb.min.z, min.z);
+	computeBounds(m);
+	createModelBuffers(m, &vertices[0], vertices.size(), &indices[0], indices.size());
 
-		m.bb.max.x = glm::max(m.bb.max.x, max.x);
-		m.bb.max.y = glm::max(m.bb.max.y, max.y);
-		m.bb.max.z = glm::max(m.bb.max.z, max.z);
+	if (sourceHash != 0)
+	{
+		writeMeshCache(cacheFilename, sourceHash, m, vertices, indices);
 	}
 
 	return m;
@@ -192,38 +424,132 @@ void clearMeshes()
 		glDeleteBuffers(1, &(*it).vbo);
 		glDeleteVertexArrays(1, &(*it).vao);
 	}
+
+	for (const Model &model: loadedModels)
+	{
+		glDeleteBuffers(1, &model.indirectBuffer);
+		glDeleteBuffers(1, &model.meshBuffer);
+		glDeleteBuffers(1, &model.meshIndexBuffer);
+		glDeleteBuffers(1, &model.ebo);
+		glDeleteBuffers(1, &model.vbo);
+		glDeleteVertexArrays(1, &model.vao);
+	}
 }
 
 void bindMaterial(const Material &m, Shader &shader)
 {
-	static const char *textureTypeNames[] = {
-		"none",
-		"diffuse",
-		"specular",
-		"ambient",
-		"emissive",
-		"normal", // use height map as normal map
-		"normal",
-		"shininess",
-		"opacity",
-		"displacement"
-	};
-
-	int counters[aiTextureType_UNKNOWN] = {0};
-	int counter = 0;
+	unsigned int lookups = 0;
 
 	for (unsigned int i = 0; i < m.textures.size(); i++)
 	{
-		string uniformName = "texture_";
-		uniformName += textureTypeNames[m.textureTypes[i]];
-		uniformName += std::to_string(++counters[m.textureTypes[i]]);
+		if (m.textureSlots[i] >= 0) glUniform1i(shader.materialLocations[m.textureSlots[i]], i);
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_2D, m.textures[i]->tex);
+		glBindSampler(i, getSampler(m.filter));
+		lookups++;
+	}
 
-		glUniform1i(glGetUniformLocation(shader.program, uniformName.c_str()), counter);
-		glActiveTexture(GL_TEXTURE0 + (counter++));
-		glBindTexture(GL_TEXTURE_2D, m.textures[i].tex);
+	for (int i = 0; i < SLOT_MAX; i++)
+	{
+		if (!m.missingSlots[i]) continue;
+
+		glUniform1i(shader.materialLocations[i], 6);
+		lookups++;
+	}
+
+	countUniformLookups(lookups);
+}
+
+void cullModel(Model &model, const mat4 &viewProjection)
+{
+	if (model.meshes.empty()) return;
+
+	model.visibleMeshes = cullBoxes(getFrustum(viewProjection), model.boxes, model.visible);
+
+	// Rebuild the indirect commands from the visible meshes, keeping
+	// each material's commands together
+	model.visibleCommands.clear();
+	for (DrawGroup &group: model.groups)
+	{
+		group.firstVisible = model.visibleCommands.size();
+		for (int i = group.firstCommand; i < group.firstCommand + group.commandCount; i++)
+		{
+			if (model.visible[i]) model.visibleCommands.push_back(model.commands[i]);
+		}
+		group.visibleCount = model.visibleCommands.size() - group.firstVisible;
+	}
+
+	if (model.visibleCommands.empty()) return;
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, model.indirectBuffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, model.commands.size() * sizeof(DrawCommand), 0, GL_DYNAMIC_DRAW);
+	glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, model.visibleCommands.size() * sizeof(DrawCommand), &model.visibleCommands[0]);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void drawModel(const Model &model, Shader &shader, bool bindMaterials)
+{
+	if (model.meshes.empty()) return;
+
+	glBindVertexArray(model.vao);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, model.indirectBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, model.meshBuffer);
+
+	if (bindMaterials)
+	{
+		// One multi draw per material
+		unsigned int units = 0;
+		for (const DrawGroup &group: model.groups)
+		{
+			if (group.visibleCount == 0) continue;
+
+			const Material &material = model.materials[group.materialIndex];
+			units = glm::max(units, (unsigned int)material.textures.size());
+
+			bindMaterial(material, shader);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+										(GLvoid*)(group.firstVisible * sizeof(DrawCommand)), group.visibleCount, 0);
+		}
+
+		// Other passes use these units with the textures' own state
+		for (unsigned int i = 0; i < units; i++)
+		{
+			glBindSampler(i, 0);
+		}
+	}
+	else if (model.visibleMeshes > 0)
+	{
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, model.visibleMeshes, 0);
 	}
 
-	if (counters[aiTextureType_DIFFUSE] == 0) glUniform1i(glGetUniformLocation(shader.program, "texture_diffuse1"), 6);
-	if (counters[aiTextureType_SPECULAR] == 0) glUniform1i(glGetUniformLocation(shader.program, "texture_specular1"), 6);
-	if (counters[aiTextureType_HEIGHT] == 0) glUniform1i(glGetUniformLocation(shader.program, "texture_normal1"), 6);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	glBindVertexArray(0);
+}
+
+void drawMesh(const Model &model, const Mesh &mesh)
+{
+	glBindVertexArray(model.vao);
+	glDrawElementsBaseVertex(GL_TRIANGLES, mesh.elements, GL_UNSIGNED_INT,
+							 (GLvoid*)(mesh.firstIndex * sizeof(GLuint)), mesh.baseVertex);
+}
+
+void drawMeshInstanced(const Model &model, const Mesh &mesh, int instances)
+{
+	// The mesh index attribute has one entry per mesh, so with many
+	// instances it would be read past its end. The mesh's own index
+	// is set as a constant instead while drawing
+	glBindVertexArray(model.vao);
+	glDisableVertexAttribArray(5);
+	glVertexAttribI1ui(5, GLuint(&mesh - &model.meshes[0]));
+	glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.elements, GL_UNSIGNED_INT,
+									  (GLvoid*)(mesh.firstIndex * sizeof(GLuint)), instances, mesh.baseVertex);
+	glEnableVertexAttribArray(5);
+}
+
+void setTextureFilter(Model &model, TextureFilter filter)
+{
+	for (Material &material: model.materials)
+	{
+		material.filter = filter;
+	}
 }
@@ -4,6 +4,7 @@
 #include "main.h"
 #include "texture.h"
 #include "shader.h"
+#include "culling.h"
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -20,8 +21,15 @@ struct Vertex
 
 struct Material
 {
-	vector<Texture> textures;
+	vector<const Texture*> textures;
 	vector<aiTextureType> textureTypes;
+	vector<string> texturePaths;
+	TextureFilter filter = FILTER_ANISOTROPIC;
+
+	// Sampler each texture is bound to, or -1, and the samplers
+	// left without a texture. Texture i always uses unit i
+	vector<int> textureSlots;
+	bool missingSlots[SLOT_MAX] = {true, true, true};
 };
 
 struct BoundingBox
@@ -32,25 +40,84 @@ struct BoundingBox
 
 struct Mesh
 {
-	GLuint vao;
-	GLuint vbo;
-	GLuint ebo;
+	GLuint vao = 0;
+	GLuint vbo = 0;
+	GLuint ebo = 0;
+
+	// Location of the mesh in its model's buffers
+	GLuint firstIndex = 0;
+	GLint baseVertex = 0;
 
 	int elements;
 	mat4 transform;
-	Material material;
+	int materialIndex = 0;
 	BoundingBox bb;
+	BoundingBox worldBB;
+};
+
+// Per mesh data read by the vertex shaders, see Shaders/mesh.in
+struct MeshData
+{
+	mat4 transform;
+	GLuint materialIndex;
+	GLuint padding[3];
+	vec4 boxMin;
+	vec4 boxMax;
+};
+
+// Layout of glMultiDrawElementsIndirect commands
+struct DrawCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// Range of draw commands sharing a material, in commands
+// and in the visible commands left after culling
+struct DrawGroup
+{
+	int materialIndex;
+	int firstCommand;
+	int commandCount;
+	int firstVisible;
+	int visibleCount;
 };
 
 struct Model
 {
+	// All meshes share one vertex and index buffer
+	GLuint vao = 0;
+	GLuint vbo = 0;
+	GLuint ebo = 0;
+	GLuint meshIndexBuffer = 0;
+	GLuint meshBuffer = 0;
+	GLuint indirectBuffer = 0;
+
 	vector<Mesh> meshes;
+	vector<Material> materials;
+	vector<DrawCommand> commands;
+	vector<DrawGroup> groups;
 	BoundingBox bb;
+
+	// World space mesh bounding boxes and the result of the last cull
+	BoxList boxes;
+	vector<char> visible;
+	vector<DrawCommand> visibleCommands;
+	int visibleMeshes = 0;
 };
 
-Mesh createMesh(vector<Vertex> vertices, vector<GLuint> indices, mat4 transform = mat4(1.0), Material material = Material(), BoundingBox bb = BoundingBox());
+Mesh createMesh(vector<Vertex> vertices, vector<GLuint> indices, mat4 transform = mat4(1.0), BoundingBox bb = BoundingBox());
 Model loadModel(const string &filename);
 void clearMeshes();
 void bindMaterial(const Material &m, Shader &shader);
+void setTextureFilter(Model &model, TextureFilter filter);
+BoundingBox transformBoundingBox(const BoundingBox &bb, const mat4 &transform);
+void cullModel(Model &model, const mat4 &viewProjection);
+void drawModel(const Model &model, Shader &shader, bool bindMaterials = true);
+void drawMesh(const Model &model, const Mesh &mesh);
+void drawMeshInstanced(const Model &model, const Mesh &mesh, int instances);
 
 #endif // _MODEL_H_INCLUDED_
@@ -0,0 +1,216 @@
+#include "profiler.h"
+
+// Queries are double buffered: results for a frame are read back
+// at the start of the frame after next, when they are ready, so
+// reading them doesn't stall the pipeline. Only the log waits for
+// results that aren't, so that it has a row for every frame
+const int TIMER_BUFFERS = 2;
+
+GLuint timerQueries[TIMER_BUFFERS][PASS_MAX][2];
+bool timerIssued[TIMER_BUFFERS][PASS_MAX];
+unsigned int timerFrame = 0;
+
+bool passTimed[PASS_MAX];
+double passTimes[PASS_MAX];
+int timedFrame = -1;
+
+// Triangles and fragments drawn for the scene geometry, summed over
+// every pass that draws the model. Buffered like the timers
+const int MAX_GEOMETRY_QUERIES = 4;
+
+GLuint geometryQueries[TIMER_BUFFERS][MAX_GEOMETRY_QUERIES][2];
+int geometryQueryCount[TIMER_BUFFERS];
+
+GLuint64 trianglesDrawn = 0;
+GLuint64 fragmentsDrawn = 0;
+
+std::ofstream timerLog;
+
+void readTimers(int set, unsigned int frame)
+{
+	// Queries finish in order, so if the last one is available, they all are
+	GLuint lastQuery = 0;
+	for (int i = 0; i < PASS_MAX; i++)
+	{
+		if (timerIssued[set][i]) lastQuery = timerQueries[set][i][1];
+	}
+
+	if (lastQuery == 0) return;
+
+	// The set is reused next frame, so when logging, wait for the
+	// results rather than leave the frame out of the log
+	GLint available = 0;
+	glGetQueryObjectiv(lastQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available && !timerLog.is_open()) return;
+
+	trianglesDrawn = 0;
+	fragmentsDrawn = 0;
+	for (int i = 0; i < geometryQueryCount[set]; i++)
+	{
+		GLuint64 triangles, fragments;
+		glGetQueryObjectui64v(geometryQueries[set][i][0], GL_QUERY_RESULT, &triangles);
+		glGetQueryObjectui64v(geometryQueries[set][i][1], GL_QUERY_RESULT, &fragments);
+		trianglesDrawn += triangles;
+		fragmentsDrawn += fragments;
+	}
+
+	timedFrame = frame;
+	for (int i = 0; i < PASS_MAX; i++)
+	{
+		passTimed[i] = timerIssued[set][i];
+		passTimes[i] = 0.0;
+
+		if (passTimed[i])
+		{
+			GLuint64 start, end;
+			glGetQueryObjectui64v(timerQueries[set][i][0], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(timerQueries[set][i][1], GL_QUERY_RESULT, &end);
+			passTimes[i] = (end - start) / 1000000.0;
+		}
+	}
+
+	if (timerLog.is_open())
+	{
+		timerLog<<frame;
+		for (int i = 0; i < PASS_MAX; i++)
+		{
+			timerLog<<","<<passTimes[i];
+		}
+		timerLog<<","<<getTotalPassTime()<<"\n";
+	}
+}
+
+void initProfiler(const string &logFilename)
+{
+	glGenQueries(TIMER_BUFFERS * PASS_MAX * 2, &timerQueries[0][0][0]);
+	glGenQueries(TIMER_BUFFERS * MAX_GEOMETRY_QUERIES * 2, &geometryQueries[0][0][0]);
+
+	for (int i = 0; i < PASS_MAX; i++)
+	{
+		passTimed[i] = false;
+		passTimes[i] = 0.0;
+		for (int j = 0; j < TIMER_BUFFERS; j++) timerIssued[j][i] = false;
+	}
+
+	for (int j = 0; j < TIMER_BUFFERS; j++) geometryQueryCount[j] = 0;
+
+	if (logFilename != "")
+	{
+		timerLog.open(logFilename.c_str());
+
+		if (!timerLog.is_open())
+		{
+			cerr<<"Failed to open GPU timer log '"<<logFilename<<"'."<<endl;
+			return;
+		}
+
+		// All times in milliseconds
+		timerLog<<"frame";
+		for (int i = 0; i < PASS_MAX; i++)
+		{
+			timerLog<<","<<GpuPassStr[i];
+		}
+		timerLog<<",Total\n";
+	}
+}
+
+void clearProfiler()
+{
+	glDeleteQueries(TIMER_BUFFERS * PASS_MAX * 2, &timerQueries[0][0][0]);
+	glDeleteQueries(TIMER_BUFFERS * MAX_GEOMETRY_QUERIES * 2, &geometryQueries[0][0][0]);
+
+	if (timerLog.is_open()) timerLog.close();
+}
+
+void beginProfilerFrame()
+{
+	int set = timerFrame % TIMER_BUFFERS;
+
+	if (timerFrame >= TIMER_BUFFERS)
+	{
+		readTimers(set, timerFrame - TIMER_BUFFERS);
+	}
+
+	for (int i = 0; i < PASS_MAX; i++)
+	{
+		timerIssued[set][i] = false;
+	}
+	geometryQueryCount[set] = 0;
+}
+
+void endProfilerFrame()
+{
+	timerFrame++;
+}
+
+unsigned int getProfilerFrame()
+{
+	return timerFrame;
+}
+
+int getTimedFrame()
+{
+	return timedFrame;
+}
+
+void beginPass(GpuPass pass)
+{
+	int set = timerFrame % TIMER_BUFFERS;
+	glQueryCounter(timerQueries[set][pass][0], GL_TIMESTAMP);
+}
+
+void endPass(GpuPass pass)
+{
+	int set = timerFrame % TIMER_BUFFERS;
+	glQueryCounter(timerQueries[set][pass][1], GL_TIMESTAMP);
+	timerIssued[set][pass] = true;
+}
+
+bool wasPassTimed(GpuPass pass)
+{
+	return passTimed[pass];
+}
+
+double getPassTime(GpuPass pass)
+{
+	return passTimes[pass];
+}
+
+double getTotalPassTime()
+{
+	double total = 0.0;
+	for (int i = 0; i < PASS_MAX; i++)
+	{
+		total += passTimes[i];
+	}
+	return total;
+}
+
+void beginGeometryQuery()
+{
+	int set = timerFrame % TIMER_BUFFERS;
+	if (geometryQueryCount[set] >= MAX_GEOMETRY_QUERIES) return;
+
+	glBeginQuery(GL_PRIMITIVES_GENERATED, geometryQueries[set][geometryQueryCount[set]][0]);
+	glBeginQuery(GL_SAMPLES_PASSED, geometryQueries[set][geometryQueryCount[set]][1]);
+}
+
+void endGeometryQuery()
+{
+	int set = timerFrame % TIMER_BUFFERS;
+	if (geometryQueryCount[set] >= MAX_GEOMETRY_QUERIES) return;
+
+	glEndQuery(GL_PRIMITIVES_GENERATED);
+	glEndQuery(GL_SAMPLES_PASSED);
+	geometryQueryCount[set]++;
+}
+
+GLuint64 getTrianglesDrawn()
+{
+	return trianglesDrawn;
+}
+
+GLuint64 getFragmentsDrawn()
+{
+	return fragmentsDrawn;
+}
@@ -0,0 +1,53 @@
+#ifndef _PROFILER_H_INCLUDED_
+#define _PROFILER_H_INCLUDED_
+
+#include "main.h"
+
+enum GpuPass
+{
+	PASS_LIGHT_ANIMATION = 0,
+	PASS_OCCLUSION_CULL,
+	PASS_DEPTH,
+	PASS_GBUFFER,
+	PASS_COARSE_LIGHT_CULL,
+	PASS_LIGHT_CULL,
+	PASS_SHADING,
+	PASS_LIGHT_SPHERES,
+	PASS_HI_Z,
+	PASS_HUD,
+
+	PASS_MAX
+};
+
+static const char *GpuPassStr[] = {
+	"Light animation",
+	"Occlusion culling",
+	"Depth",
+	"GBuffer",
+	"Coarse light culling",
+	"Light culling",
+	"Shading",
+	"Light spheres",
+	"Hi-Z",
+	"HUD"
+};
+
+void initProfiler(const string &logFilename = "");
+void clearProfiler();
+void beginProfilerFrame();
+void endProfilerFrame();
+unsigned int getProfilerFrame();
+// Frame the current pass times were measured in, -1 before the first
+// results. They stay the same while newer results are still pending
+int getTimedFrame();
+void beginPass(GpuPass pass);
+void endPass(GpuPass pass);
+bool wasPassTimed(GpuPass pass);
+double getPassTime(GpuPass pass);
+double getTotalPassTime();
+void beginGeometryQuery();
+void endGeometryQuery();
+GLuint64 getTrianglesDrawn();
+GLuint64 getFragmentsDrawn();
+
+#endif // _PROFILER_H_INCLUDED_
@@ -1,7 +1,22 @@
 #include "shader.h"
 #include "sstream"
+#include <cstring>
+
+const char PROGRAM_CACHE_MAGIC[8] = {'R', 'D', 'P', 'R', 'O', 'G', '\0', '\0'};
+
+// Cached program binaries are stored next to the shader sources, one
+// file per shader and define set
+struct ProgramCacheHeader
+{
+	char magic[8];
+	uint64_t hash;
+	GLenum format;
+	GLuint length;
+};
 
 unordered_map<string, Shader> shaders;
+bool shaderCache = true;
+unsigned int uniformLookups = 0;
 
 string loadShader(const string& fileName, const vector<string> defines = {})
 {
@@ -13,9 +28,6 @@ string loadShader(const string& fileName, const vector<string> defines = {})
 
 	if (file.is_open())
 	{
-		int headerLinesSkipped = 0;
-		int curLine = 0;
-
 		while (file.good())
 		{
 			getline(file, line);
@@ -31,15 +43,10 @@ string loadShader(const string& fileName, const vector<string> defines = {})
 			}
 			else
 			{
-				if(line.find("#version") == 0 || line.find("precision") == 0)
-				{
-					headerLinesSkipped++;
-				}
-
 				result.append(line + "\n");
-				curLine++;
 
-				if (headerLinesSkipped == 2 && curLine < 3)
+				// Defines have to come right after the #version directive
+				if (line.find("#version") == 0)
 				{
 					for (int i = 0; i < defines.size(); i++)
 					{
@@ -47,7 +54,6 @@ string loadShader(const string& fileName, const vector<string> defines = {})
 						result.append(defines[i]);
 						result.append("\n");
 					}
-					curLine = 3;
 				}
 			}
 		}
@@ -124,9 +130,8 @@ bool checkShaderError(GLuint shader, const string &errorMessage, const string &f
 	return true;
 }
 
-bool createShader(const string &fileName, unsigned int type, GLuint &shader, const vector<string> &defines)
+bool createShader(const string &fileName, const string &source, unsigned int type, GLuint &shader)
 {
-	const string source = loadShader(fileName, defines);
 	const GLchar *s = source.c_str();
 	GLint length = source.length();
 
@@ -152,6 +157,107 @@ bool createShader(const string &fileName, unsigned int type, GLuint &shader, con
 	return true;
 }
 
+uint64_t hashString(const string &s, uint64_t hash = 14695981039346656037ULL)
+{
+	// 64 bit FNV-1a, the terminating 0 separates consecutive strings
+	for (unsigned int i = 0; i <= s.size(); i++)
+	{
+		hash = (hash ^ (unsigned char)s.c_str()[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+bool loadProgramBinary(const string &fileName, uint64_t hash, GLuint program)
+{
+	std::ifstream file(fileName.c_str(), std::ios::binary);
+	if (!file.is_open()) return false;
+
+	ProgramCacheHeader header;
+	if (!file.read((char*)&header, sizeof(header)) ||
+		std::memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.hash != hash)
+	{
+		return false;
+	}
+
+	vector<char> binary(header.length);
+	if (!file.read(&binary[0], binary.size())) return false;
+
+	// Fails when the driver no longer accepts the binary, and the
+	// program is then compiled as usual
+	glProgramBinary(program, header.format, &binary[0], binary.size());
+
+	GLint success = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	return success == GL_TRUE;
+}
+
+void saveProgramBinary(const string &fileName, uint64_t hash, GLuint program)
+{
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) return;
+
+	ProgramCacheHeader header;
+	std::memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic));
+	header.hash = hash;
+
+	vector<char> binary(length);
+	glGetProgramBinary(program, length, &length, &header.format, &binary[0]);
+	header.length = length;
+
+	// Written under another name first, so other runs never see a partial file
+	string tempName = fileName + ".tmp";
+	{
+		std::ofstream file(tempName.c_str(), std::ios::binary);
+		file.write((const char*)&header, sizeof(header));
+		file.write(&binary[0], length);
+		if (!file.good())
+		{
+			cerr<<"Could not write shader cache '"<<fileName<<"'."<<endl;
+			return;
+		}
+	}
+
+	std::remove(fileName.c_str());
+	std::rename(tempName.c_str(), fileName.c_str());
+}
+
+void reflectUniforms(Shader &s)
+{
+	GLint count = 0;
+	GLint maxLength = 0;
+	glGetProgramiv(s.program, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(s.program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+	vector<GLchar> name(maxLength + 1);
+	for (GLint i = 0; i < count; i++)
+	{
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(s.program, i, name.size(), NULL, &size, &type, &name[0]);
+
+		// Uniforms in blocks have no location
+		GLint location = glGetUniformLocation(s.program, &name[0]);
+		if (location < 0) continue;
+
+		// Arrays are listed as "name[0]", and can be set by their bare name too
+		string uniformName = &name[0];
+		s.uniforms.push_back({uniformName, location});
+		if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+		{
+			s.uniforms.push_back({uniformName.substr(0, uniformName.size() - 3), location});
+		}
+	}
+
+	std::sort(s.uniforms.begin(), s.uniforms.end(), [](const Uniform &a, const Uniform &b) { return a.name < b.name; });
+
+	for (int i = 0; i < SLOT_MAX; i++)
+	{
+		s.materialLocations[i] = s.getUniformLocation(MaterialSlotStr[i]);
+	}
+}
+
 const Shader &getShader(const string &shaderName, const vector<string> &defines)
 {
 	string uid = shaderName;
@@ -168,21 +274,49 @@ const Shader &getShader(const string &shaderName, const vector<string> &defines)
 
 		s.program = glCreateProgram();
 
-		vector<string> vsDefines = defines;
-		vector<string> fsDefines = defines;
-		vector<string> csDefines = defines;
-		vector<string> gsDefines = defines;
-		vsDefines.push_back("VS");
-		fsDefines.push_back("FS");
-		csDefines.push_back("CS");
-		gsDefines.push_back("GS");
+		static const char *stageStr[] = {"VS", "FS", "CS", "GS"};
+		static const char *extensionStr[] = {".vs", ".fs", ".cs", ".gs"};
+		static const GLenum stageTypes[] = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_COMPUTE_SHADER, GL_GEOMETRY_SHADER};
+
+		// The binary is only valid for the exact sources and driver it was built with
+		string sources[4];
+		uint64_t hash = hashString((const char*)glGetString(GL_VENDOR));
+		hash = hashString((const char*)glGetString(GL_RENDERER), hash);
+		hash = hashString((const char*)glGetString(GL_VERSION), hash);
+
+		for (int i = 0; i < 4; i++)
+		{
+			vector<string> stageDefines = defines;
+			stageDefines.push_back(stageStr[i]);
+			sources[i] = loadShader(shaderName + extensionStr[i], stageDefines);
+			hash = hashString(sources[i], hash);
+		}
+
+		char uidHash[17];
+		std::snprintf(uidHash, sizeof(uidHash), "%016llx", (unsigned long long)hashString(uid));
+		string cacheFileName = shaderName + "-" + uidHash + ".cache";
+
+		GLint binaryFormats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormats);
+
+		if (shaderCache && binaryFormats > 0 && loadProgramBinary(cacheFileName, hash, s.program))
+		{
+			reflectUniforms(s);
+			shaders[uid] = s;
+			return shaders[uid];
+		}
 
 		int counter = 0;
 
-		if (createShader(shaderName + ".vs", GL_VERTEX_SHADER, s.shaders[counter], vsDefines)) counter++;
-		if (createShader(shaderName + ".fs", GL_FRAGMENT_SHADER, s.shaders[counter], fsDefines)) counter++;
-		if (createShader(shaderName + ".cs", GL_COMPUTE_SHADER, s.shaders[counter], csDefines)) counter++;
-		if (createShader(shaderName + ".gs", GL_GEOMETRY_SHADER, s.shaders[counter], gsDefines)) counter++;
+		for (int i = 0; i < 4; i++)
+		{
+			if (createShader(shaderName + extensionStr[i], sources[i], stageTypes[i], s.shaders[counter])) counter++;
+		}
+
+		if (shaderCache && binaryFormats > 0)
+		{
+			glProgramParameteri(s.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
 
 		for (int i = 0; s.shaders[i] != 0; i++)
 		{
@@ -214,52 +348,104 @@ const Shader &getShader(const string &shaderName, const vector<string> &defines)
 			return shaders[uid];
 		}
 
-//		GLuint ubiVP = glGetUniformBlockIndex(s.program, "matrices");
-//		glUniformBlockBinding(s.program, ubiVP, 0);
+		if (shaderCache && binaryFormats > 0) saveProgramBinary(cacheFileName, hash, s.program);
 
+		reflectUniforms(s);
 		shaders[uid] = s;
 		return shaders[uid];
 	}
 }
 
+GLint Shader::getUniformLocation(const char *name) const
+{
+	// Binary search, comparing in place to avoid building a string
+	int first = 0;
+	int last = uniforms.size() - 1;
+	while (first <= last)
+	{
+		int middle = (first + last) / 2;
+		int order = std::strcmp(uniforms[middle].name.c_str(), name);
+
+		if (order == 0) return uniforms[middle].location;
+		else if (order < 0) first = middle + 1;
+		else last = middle - 1;
+	}
+
+	return -1;
+}
+
 void Shader::setUniform(const char *name, float value)
 {
-	glUniform1f(glGetUniformLocation(program, name), value);
+	uniformLookups++;
+	glUniform1f(getUniformLocation(name), value);
 }
 
 void Shader::setUniform(const char *name, int value)
 {
-	glUniform1i(glGetUniformLocation(program, name), value);
+	uniformLookups++;
+	glUniform1i(getUniformLocation(name), value);
 }
 
 void Shader::setUniform(const char *name, bool value)
 {
-	glUniform1i(glGetUniformLocation(program, name), value);
+	uniformLookups++;
+	glUniform1i(getUniformLocation(name), value);
 }
 
 void Shader::setUniform(const char *name, GLuint value)
 {
-	glUniform1i(glGetUniformLocation(program, name), value);
+	uniformLookups++;
+	glUniform1ui(getUniformLocation(name), value);
 }
 
 void Shader::setUniform(const char *name, vec2 value)
 {
-	glUniform2fv(glGetUniformLocation(program, name), 1, glm::value_ptr(value));
+	uniformLookups++;
+	glUniform2fv(getUniformLocation(name), 1, glm::value_ptr(value));
 }
 
 void Shader::setUniform(const char *name, vec3 value)
 {
-	glUniform3fv(glGetUniformLocation(program, name), 1, glm::value_ptr(value));
+	uniformLookups++;
+	glUniform3fv(getUniformLocation(name), 1, glm::value_ptr(value));
 }
 
 void Shader::setUniform(const char *name, vec4 value)
 {
-	glUniform4fv(glGetUniformLocation(program, name), 1, glm::value_ptr(value));
+	uniformLookups++;
+	glUniform4fv(getUniformLocation(name), 1, glm::value_ptr(value));
+}
+
+void Shader::setUniform(const char *name, ivec3 value)
+{
+	uniformLookups++;
+	glUniform3iv(getUniformLocation(name), 1, glm::value_ptr(value));
 }
 
 void Shader::setUniform(const char *name, mat4 value)
 {
-	glUniformMatrix4fv(glGetUniformLocation(program, name), 1, GL_FALSE, glm::value_ptr(value));
+	uniformLookups++;
+	glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void setShaderCache(bool enabled)
+{
+	shaderCache = enabled;
+}
+
+void countUniformLookups(unsigned int count)
+{
+	uniformLookups += count;
+}
+
+unsigned int getUniformLookups()
+{
+	return uniformLookups;
+}
+
+void resetUniformLookups()
+{
+	uniformLookups = 0;
 }
 
 void clearShaders()
@@ -3,11 +3,40 @@
 
 #include "main.h"
 
+// Sampler uniforms that material textures are bound to
+enum MaterialSlot
+{
+	SLOT_DIFFUSE = 0,
+	SLOT_SPECULAR,
+	SLOT_NORMAL,
+
+	SLOT_MAX
+};
+
+static const char *MaterialSlotStr[] = {
+	"texture_diffuse1",
+	"texture_specular1",
+	"texture_normal1"
+};
+
+struct Uniform
+{
+	string name;
+	GLint location;
+};
+
 struct Shader
 {
 	GLuint program = 0;
 	GLuint shaders[5] = {0};
 
+	// Active uniforms sorted by name, and the material sampler
+	// locations, both read once after linking
+	vector<Uniform> uniforms;
+	GLint materialLocations[SLOT_MAX] = {-1, -1, -1};
+
+	GLint getUniformLocation(const char *name) const;
+
 	void setUniform(const char *name, float value);
 	void setUniform(const char *name, int value);
 	void setUniform(const char *name, bool value);
@@ -15,10 +44,20 @@ struct Shader
 	void setUniform(const char *name, vec2 value);
 	void setUniform(const char *name, vec3 value);
 	void setUniform(const char *name, vec4 value);
+	void setUniform(const char *name, ivec3 value);
 	void setUniform(const char *name, mat4 value);
 };
 
+// Linked programs are saved with glGetProgramBinary and loaded from
+// there while the sources, defines and driver stay the same
 const Shader &getShader(const string &shaderName, const vector<string> &defines = {});
+void setShaderCache(bool enabled);
+
+// Counts uniform locations taken from the reflected tables, each of
+// which used to be a glGetUniformLocation call
+void countUniformLookups(unsigned int count);
+unsigned int getUniformLookups();
+void resetUniformLookups();
 void clearShaders();
 
 #endif // _SHADER_H_INCLUDED_
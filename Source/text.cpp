@@ -6,7 +6,7 @@
 
 Font font;
 Shader fontShader;
-Texture fontTexture;
+const Texture *fontTexture;
 GLuint textVAO;
 GLuint textVBO;
 vector<vec2> quads;
@@ -76,7 +76,7 @@ void endRenderText()
 
 	glUseProgram(fontShader.program);
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, fontTexture.tex);
+	glBindTexture(GL_TEXTURE_2D, fontTexture->tex);
 
 	glDisable(GL_DEPTH_TEST);
 	glDisable(GL_CULL_FACE);
@@ -98,12 +98,14 @@ void endRenderText()
 void initFont(int screenWidth, int screenHeight)
 {
 	fontShader = getShader("Shaders/font");
+	// Text size depends on the texture size, so wait for it
 	fontTexture = getTexture("font_0.png");
+	updateTextures(true);
 
 	glUseProgram(fontShader.program);
-	fontShader.setUniform("texture", 0);
+	fontShader.setUniform("fontTexture", 0);
 	fontShader.setUniform("screenSize", vec2(screenWidth, screenHeight));
-	fontShader.setUniform("texSize", vec2(fontTexture.width, fontTexture.height));
+	fontShader.setUniform("texSize", vec2(fontTexture->width, fontTexture->height));
 	glUseProgram(0);
 
 	glGenVertexArrays(1, &textVAO);
@@ -1,52 +1,349 @@
 #include "texture.h"
+#include "threadpool.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#include <cmath>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+const float MAX_ANISOTROPY = 16.0f;
+const int UPLOAD_BUFFERS = 4;
+const GLuint64 UPLOAD_TIMEOUT = 100000000; // ns
+
 unordered_map<string, Texture> textures;
+GLuint samplers[FILTER_MAX];
+
+// sRGB decoding of every byte value, and encoding of linear
+// values quantized to 12 bits
+float srgbToLinear[256];
+unsigned char linearToSrgb[4096];
+
+void initSrgbTables()
+{
+	static bool initialized = false;
+	if (initialized) return;
+
+	for (int i = 0; i < 256; i++)
+	{
+		float c = i / 255.0f;
+		srgbToLinear[i] = (c <= 0.04045f)? c / 12.92f: std::pow((c + 0.055f) / 1.055f, 2.4f);
+	}
+
+	for (int i = 0; i < 4096; i++)
+	{
+		float c = i / 4095.0f;
+		c = (c <= 0.0031308f)? c * 12.92f: 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+		linearToSrgb[i] = (unsigned char)(c * 255.0f + 0.5f);
+	}
+
+	initialized = true;
+}
+
+void downsample(const unsigned char *src, int srcWidth, int srcHeight,
+				unsigned char *dst, int dstWidth, int dstHeight, bool srgb)
+{
+	// Box filter over the source texels each destination texel covers.
+	// Sizes are halved and rounded down, so for odd sizes the last
+	// row and column cover three texels
+	parallelFor(dstHeight, [=](int begin, int end)
+	{
+		for (int y = begin; y < end; y++)
+		{
+			int y0 = y * srcHeight / dstHeight;
+			int y1 = glm::max((y + 1) * srcHeight / dstHeight, y0 + 1);
+
+			for (int x = 0; x < dstWidth; x++)
+			{
+				int x0 = x * srcWidth / dstWidth;
+				int x1 = glm::max((x + 1) * srcWidth / dstWidth, x0 + 1);
+
+				float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+				for (int sy = y0; sy < y1; sy++)
+				{
+					const unsigned char *texel = src + (sy * srcWidth + x0) * 4;
+					for (int sx = x0; sx < x1; sx++, texel += 4)
+					{
+						for (int c = 0; c < 3; c++)
+						{
+							sum[c] += srgb? srgbToLinear[texel[c]]: texel[c] / 255.0f;
+						}
+						sum[3] += texel[3] / 255.0f;
+					}
+				}
+
+				float scale = 1.0f / ((x1 - x0) * (y1 - y0));
+				unsigned char *out = dst + (y * dstWidth + x) * 4;
+				for (int c = 0; c < 3; c++)
+				{
+					float v = sum[c] * scale;
+					out[c] = srgb? linearToSrgb[int(v * 4095.0f + 0.5f)]: (unsigned char)(v * 255.0f + 0.5f);
+				}
+				out[3] = (unsigned char)(sum[3] * scale * 255.0f + 0.5f);
+			}
+		}
+	});
+}
+
+// Decoded image with its mip chain, waiting for the main thread
+struct DecodedTexture
+{
+	Texture *texture;
+	string filename;
+	int width = 0;
+	int height = 0;
+	int components = 0;
+	int levels = 0;
+
+	// All levels back to back, level 0 first
+	vector<unsigned char> data;
+	vector<size_t> levelOffsets;
+};
+
+// Pixel unpack buffers that uploads cycle through. A buffer is reused
+// once the fence placed after its last upload has passed
+struct UploadBuffer
+{
+	GLuint pbo = 0;
+	GLsizeiptr size = 0;
+	GLsync fence = 0;
+};
+
+std::deque<shared_ptr<DecodedTexture>> decodedTextures;
+std::mutex decodedMutex;
+std::condition_variable textureDecoded;
+int texturesLoading = 0;
+
+UploadBuffer uploadBuffers[UPLOAD_BUFFERS];
+int nextUploadBuffer = 0;
+
+void decodeTexture(DecodedTexture &d, bool srgb)
+{
+	unsigned char *data = stbi_load(d.filename.c_str(), &d.width, &d.height, &d.components, 4);
+	if (!data) return;
+
+	d.levels = 1;
+	while ((glm::max(d.width, d.height) >> d.levels) > 0) d.levels++;
+
+	size_t size = 0;
+	for (int level = 0; level < d.levels; level++)
+	{
+		d.levelOffsets.push_back(size);
+		size += (size_t)glm::max(d.width >> level, 1) * glm::max(d.height >> level, 1) * 4;
+	}
+
+	d.data.resize(size);
+	std::copy(data, data + (size_t)d.width * d.height * 4, d.data.begin());
+	stbi_image_free(data);
+
+	// Each level is built from the one above
+	int width = d.width;
+	int height = d.height;
+
+	for (int level = 1; level < d.levels; level++)
+	{
+		int levelWidth = glm::max(width / 2, 1);
+		int levelHeight = glm::max(height / 2, 1);
+
+		downsample(&d.data[d.levelOffsets[level - 1]], width, height,
+				   &d.data[d.levelOffsets[level]], levelWidth, levelHeight, srgb);
+
+		width = levelWidth;
+		height = levelHeight;
+	}
+}
+
+const Texture *getTexture(const string &filename, bool srgb)
+{
+	unordered_map<string, Texture>::iterator it = textures.find(filename);
+	if (it != textures.end()) return &it->second;
+
+	// Map elements don't move when it grows, so the pointer stays valid
+	Texture *t = &textures[filename];
+
+	shared_ptr<DecodedTexture> d = std::make_shared<DecodedTexture>();
+	d->texture = t;
+	d->filename = filename;
+
+	initSrgbTables();
+	texturesLoading++;
+
+	runTask([d, srgb]
+	{
+		decodeTexture(*d, srgb);
 
-const Texture &getTexture(const string &filename)
+		std::lock_guard<std::mutex> lock(decodedMutex);
+		decodedTextures.push_back(d);
+		textureDecoded.notify_one();
+	});
+
+	return t;
+}
+
+bool uploadTexture(const DecodedTexture &d, bool wait)
+{
+	UploadBuffer &buffer = uploadBuffers[nextUploadBuffer];
+
+	if (buffer.fence)
+	{
+		GLenum result;
+		do
+		{
+			result = glClientWaitSync(buffer.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait? UPLOAD_TIMEOUT: 0);
+		}
+		while (wait && result == GL_TIMEOUT_EXPIRED);
+
+		if (result == GL_TIMEOUT_EXPIRED) return false;
+
+		glDeleteSync(buffer.fence);
+		buffer.fence = 0;
+	}
+
+	nextUploadBuffer = (nextUploadBuffer + 1) % UPLOAD_BUFFERS;
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.pbo);
+	if (buffer.size < (GLsizeiptr)d.data.size())
+	{
+		buffer.size = d.data.size();
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, buffer.size, 0, GL_STREAM_DRAW);
+	}
+
+	// The fence has passed, so the GL is done reading the old contents
+	void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, d.data.size(),
+									GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	std::copy(d.data.begin(), d.data.end(), (unsigned char*)mapped);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	Texture &t = *d.texture;
+	t.width = d.width;
+	t.height = d.height;
+	t.components = d.components;
+	t.levels = d.levels;
+
+	glGenTextures(1, &t.tex);
+	glBindTexture(GL_TEXTURE_2D, t.tex);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+	glTexStorage2D(GL_TEXTURE_2D, t.levels, GL_RGBA8, t.width, t.height);
+	for (int level = 0; level < t.levels; level++)
+	{
+		glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, glm::max(t.width >> level, 1), glm::max(t.height >> level, 1),
+						GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)d.levelOffsets[level]);
+	}
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	return true;
+}
+
+int updateTextures(bool wait)
 {
-	if (textures.find(filename) != textures.end()) return textures[filename];
-	else
+	if (uploadBuffers[0].pbo == 0)
 	{
-		Texture t;
+		for (int i = 0; i < UPLOAD_BUFFERS; i++)
+		{
+			glGenBuffers(1, &uploadBuffers[i].pbo);
+		}
+	}
 
-		unsigned char *data = stbi_load(filename.c_str(), &t.width, &t.height, &t.components, 4);
+	while (texturesLoading > 0)
+	{
+		shared_ptr<DecodedTexture> d;
+		{
+			std::unique_lock<std::mutex> lock(decodedMutex);
+			if (wait) textureDecoded.wait(lock, []{ return !decodedTextures.empty(); });
+			if (decodedTextures.empty()) break;
 
-		if (!data)
+			d = decodedTextures.front();
+		}
+
+		if (d->data.empty())
 		{
-			cerr<<"Texture loading failed for '"<<filename<<"'."<<endl;
+			cerr<<"Texture loading failed for '"<<d->filename<<"'."<<endl;
 		}
-		else
+		else if (!uploadTexture(*d, wait))
 		{
-			glGenTextures(1, &t.tex);
-			glBindTexture(GL_TEXTURE_2D, t.tex);
+			// All upload buffers are in use, try again next frame
+			break;
+		}
 
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		std::lock_guard<std::mutex> lock(decodedMutex);
+		decodedTextures.pop_front();
+		texturesLoading--;
+	}
 
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	return texturesLoading;
+}
 
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, t.width, t.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+GLuint getSampler(TextureFilter filter)
+{
+	if (samplers[filter] != 0) return samplers[filter];
 
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	GLuint &s = samplers[filter];
+	glGenSamplers(1, &s);
 
-			glBindTexture(GL_TEXTURE_2D, 0);
+	glSamplerParameteri(s, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glSamplerParameteri(s, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glSamplerParameteri(s, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-			stbi_image_free(data);
+	switch (filter)
+	{
+	case FILTER_BILINEAR:
+		// Level 0 only, as textures were sampled before they had mipmaps
+		glSamplerParameteri(s, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		break;
+
+	case FILTER_TRILINEAR:
+		glSamplerParameteri(s, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		break;
+
+	case FILTER_ANISOTROPIC:
+		glSamplerParameteri(s, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		if (GLEW_EXT_texture_filter_anisotropic)
+		{
+			float maxAnisotropy = 1.0f;
+			glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAnisotropy);
+			glSamplerParameterf(s, GL_TEXTURE_MAX_ANISOTROPY_EXT, glm::min(maxAnisotropy, MAX_ANISOTROPY));
 		}
+		break;
 
-		textures[filename] = t;
-		return textures[filename];
+	default:
+		break;
 	}
+
+	return s;
 }
 
 void clearTextures()
 {
+	// Workers have stopped by now, anything decoded is dropped
+	decodedTextures.clear();
+	texturesLoading = 0;
+
+	for (int i = 0; i < UPLOAD_BUFFERS; i++)
+	{
+		if (uploadBuffers[i].fence) glDeleteSync(uploadBuffers[i].fence);
+		if (uploadBuffers[i].pbo != 0) glDeleteBuffers(1, &uploadBuffers[i].pbo);
+		uploadBuffers[i] = UploadBuffer();
+	}
+	nextUploadBuffer = 0;
+
 	for (unordered_map<string, Texture>::iterator it = textures.begin(); it != textures.end(); it++)
 	{
 		if (it->second.tex != 0) glDeleteTextures(1, &it->second.tex);
 	}
+
+	for (int i = 0; i < FILTER_MAX; i++)
+	{
+		if (samplers[i] != 0) glDeleteSamplers(1, &samplers[i]);
+		samplers[i] = 0;
+	}
 }
@@ -3,15 +3,43 @@
 
 #include "main.h"
 
+// Textures are decoded on the worker threads. tex stays 0 until the
+// main thread has uploaded the texture in updateTextures
 struct Texture
 {
 	GLuint tex = 0;
 	int width = 0;
 	int height = 0;
 	int components = 0;
+	int levels = 0;
 };
 
-const Texture &getTexture(const string &filename);
+enum TextureFilter
+{
+	FILTER_BILINEAR = 0,
+	FILTER_TRILINEAR,
+	FILTER_ANISOTROPIC,
+
+	FILTER_MAX
+};
+
+static const char *TextureFilterStr[] = {
+	"Bilinear",
+	"Trilinear",
+	"Anisotropic"
+};
+
+// Queues a texture for loading, and returns a handle that stays valid
+// until clearTextures. srgb textures (diffuse maps) are filtered in
+// linear space when building their mip chain. Data textures (normal,
+// specular) are not
+const Texture *getTexture(const string &filename, bool srgb = false);
+
+// Uploads the textures decoded so far, and returns how many are still
+// loading. With wait set, returns once all are uploaded
+int updateTextures(bool wait = false);
+
+GLuint getSampler(TextureFilter filter);
 void clearTextures();
 
 #endif // _LOADER_H_INCLUDED_
@@ -0,0 +1,145 @@
+#include "threadpool.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+
+vector<std::thread> workers;
+std::deque<std::function<void()>> taskQueue;
+std::mutex taskMutex;
+std::condition_variable taskAvailable;
+bool stopWorkers = false;
+
+void workerMain()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(taskMutex);
+			taskAvailable.wait(lock, []{ return stopWorkers || !taskQueue.empty(); });
+
+			if (taskQueue.empty()) return;
+
+			task = std::move(taskQueue.front());
+			taskQueue.pop_front();
+		}
+
+		task();
+	}
+}
+
+void initThreadPool(unsigned int threadCount)
+{
+	if (threadCount == 0)
+	{
+		unsigned int hardwareThreads = std::thread::hardware_concurrency();
+		threadCount = hardwareThreads > 1? hardwareThreads - 1: 1;
+	}
+
+	stopWorkers = false;
+	for (unsigned int i = 0; i < threadCount; i++)
+	{
+		workers.push_back(std::thread(workerMain));
+	}
+}
+
+void clearThreadPool()
+{
+	// Workers finish the queued tasks before exiting
+	{
+		std::lock_guard<std::mutex> lock(taskMutex);
+		stopWorkers = true;
+	}
+	taskAvailable.notify_all();
+
+	for (std::thread &worker: workers)
+	{
+		worker.join();
+	}
+	workers.clear();
+}
+
+unsigned int getThreadCount()
+{
+	return workers.size();
+}
+
+void runTask(const std::function<void()> &task)
+{
+	if (workers.empty())
+	{
+		task();
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(taskMutex);
+		taskQueue.push_back(task);
+	}
+	taskAvailable.notify_one();
+}
+
+struct ParallelFor
+{
+	std::function<void(int, int)> body;
+	int count;
+	int chunkSize;
+	int chunks;
+	std::atomic<int> nextChunk;
+	std::atomic<int> chunksDone;
+	std::mutex mutex;
+	std::condition_variable done;
+};
+
+void runChunks(ParallelFor &job)
+{
+	int chunk;
+	while ((chunk = job.nextChunk++) < job.chunks)
+	{
+		int begin = chunk * job.chunkSize;
+		job.body(begin, glm::min(begin + job.chunkSize, job.count));
+
+		if (++job.chunksDone == job.chunks)
+		{
+			std::lock_guard<std::mutex> lock(job.mutex);
+			job.done.notify_all();
+		}
+	}
+}
+
+void parallelFor(int count, const std::function<void(int, int)> &body)
+{
+	if (count <= 0) return;
+
+	// A few chunks per thread balances uneven work. The calling thread
+	// takes chunks too, so nested calls from a worker can't deadlock
+	int threads = workers.size() + 1;
+	int chunks = glm::min(count, threads * 4);
+
+	if (chunks == 1)
+	{
+		body(0, count);
+		return;
+	}
+
+	// Shared with workers that may only start after this returns
+	shared_ptr<ParallelFor> job = std::make_shared<ParallelFor>();
+	job->body = body;
+	job->count = count;
+	job->chunkSize = (count + chunks - 1) / chunks;
+	job->chunks = (count + job->chunkSize - 1) / job->chunkSize;
+	job->nextChunk = 0;
+	job->chunksDone = 0;
+
+	for (int i = 0; i < threads - 1; i++)
+	{
+		runTask([job]{ runChunks(*job); });
+	}
+
+	runChunks(*job);
+
+	std::unique_lock<std::mutex> lock(job->mutex);
+	job->done.wait(lock, [&]{ return job->chunksDone == job->chunks; });
+}
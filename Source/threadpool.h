@@ -0,0 +1,20 @@
+#ifndef _THREADPOOL_H_INCLUDED_
+#define _THREADPOOL_H_INCLUDED_
+
+#include "main.h"
+#include <functional>
+
+// Starts one worker per hardware thread, minus the main thread,
+// when threadCount is 0
+void initThreadPool(unsigned int threadCount = 0);
+void clearThreadPool();
+unsigned int getThreadCount();
+
+// Runs a task on a worker thread
+void runTask(const std::function<void()> &task);
+
+// Splits [0, count) into ranges and runs body(begin, end) on the
+// workers and the calling thread, returning once all are done
+void parallelFor(int count, const std::function<void(int, int)> &body);
+
+#endif // _THREADPOOL_H_INCLUDED_
@@ -0,0 +1,253 @@
+#include "tilestats.h"
+#include "profiler.h"
+
+#include <cmath>
+
+// lightCull.cs and clusterCull.cs write each tile's entry to the stats
+// buffer. It is copied into a ring of readback buffers, followed by
+// the list pool counters, and only read once their fence has passed,
+// so the stats never stall the pipeline
+const int STATS_BUFFERS = 3;
+const int STATS_COUNTERS = 3;
+const GLuint TILE_STATS_BINDING = 12;
+const GLuint64 STATS_FENCE_TIMEOUT = 100000000; // ns
+
+GLuint tileStatsBuffer = 0;
+GLuint statsReadbackBuffer = 0;
+GLuint *statsRing = nullptr;
+GLsync statsFences[STATS_BUFFERS];
+unsigned int statsFrames[STATS_BUFFERS];
+int statsTiles[STATS_BUFFERS];
+bool statsClusters[STATS_BUFFERS];
+bool statsPooled[STATS_BUFFERS];
+int statsSlot = 0;
+int statsCapacity = 0;
+
+TileStats tileStats;
+double droppedEntries = 0.0;
+double listEntries = 0.0;
+
+std::ofstream tileStatsLog;
+
+void computeTileStats(const GLuint *entries, int slot)
+{
+	int tileCount = statsTiles[slot];
+
+	TileStats stats;
+	stats.frame = statsFrames[slot];
+	stats.clusters = statsClusters[slot];
+	stats.tiles = tileCount;
+	if (statsPooled[slot])
+	{
+		stats.poolLights = entries[statsCapacity];
+		stats.listEntries = entries[statsCapacity + 1];
+		stats.droppedEntries = entries[statsCapacity + 2];
+	}
+
+	vector<GLuint> counts(tileCount);
+	double total = 0.0;
+	for (int i = 0; i < tileCount; i++)
+	{
+		if (entries[i] & TILE_OVERFLOW_BIT) stats.overflowed++;
+		counts[i] = entries[i] & ~TILE_OVERFLOW_BIT;
+		stats.max = glm::max(stats.max, counts[i]);
+		total += counts[i];
+	}
+
+	if (tileCount > 0)
+	{
+		// Nearest-rank percentile, as for frame times
+		int rank = glm::clamp(int(std::ceil(0.99 * tileCount)) - 1, 0, tileCount - 1);
+		std::nth_element(counts.begin(), counts.begin() + rank, counts.end());
+
+		stats.mean = total / tileCount;
+		stats.p99 = counts[rank];
+	}
+
+	tileStats = stats;
+	listEntries += stats.listEntries;
+	droppedEntries += stats.droppedEntries;
+
+	if (tileStatsLog.is_open())
+	{
+		tileStatsLog<<stats.frame<<","<<stats.tiles<<","<<stats.max<<","<<stats.mean<<","
+					<<stats.p99<<","<<stats.overflowed<<","<<stats.listEntries<<","
+					<<stats.droppedEntries<<"\n";
+	}
+}
+
+void initTileStats(const string &logFilename)
+{
+	for (int i = 0; i < STATS_BUFFERS; i++) statsFences[i] = 0;
+
+	if (logFilename != "")
+	{
+		tileStatsLog.open(logFilename.c_str());
+
+		if (!tileStatsLog.is_open())
+		{
+			cerr<<"Failed to open tile stats log '"<<logFilename<<"'."<<endl;
+			return;
+		}
+
+		// Light counts per tile, frames match the GPU timer log
+		tileStatsLog<<"frame,tiles,max,mean,p99,overflowed,entries,dropped\n";
+	}
+}
+
+void deleteTileStatsBuffers()
+{
+	for (int i = 0; i < STATS_BUFFERS; i++)
+	{
+		if (statsFences[i]) glDeleteSync(statsFences[i]);
+		statsFences[i] = 0;
+	}
+
+	if (statsReadbackBuffer)
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, statsReadbackBuffer);
+		if (statsRing) glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		statsRing = nullptr;
+	}
+
+	glDeleteBuffers(1, &statsReadbackBuffer);
+	glDeleteBuffers(1, &tileStatsBuffer);
+	statsReadbackBuffer = 0;
+	tileStatsBuffer = 0;
+}
+
+void resizeTileStats(int maxTileCount)
+{
+	deleteTileStatsBuffers();
+
+	statsCapacity = maxTileCount;
+	statsSlot = 0;
+	tileStats = TileStats();
+
+	// Each readback slot holds the entries and the pool counters
+	GLsizeiptr slotSize = (maxTileCount + STATS_COUNTERS) * sizeof(GLuint);
+
+	glGenBuffers(1, &tileStatsBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, tileStatsBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, maxTileCount * sizeof(GLuint), 0, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TILE_STATS_BINDING, tileStatsBuffer);
+
+	glGenBuffers(1, &statsReadbackBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, statsReadbackBuffer);
+	if (GLEW_ARB_buffer_storage)
+	{
+		GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, slotSize * STATS_BUFFERS, 0, flags);
+		statsRing = (GLuint*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, slotSize * STATS_BUFFERS, flags);
+	}
+	else
+	{
+		glBufferData(GL_COPY_WRITE_BUFFER, slotSize * STATS_BUFFERS, 0, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void clearTileStats()
+{
+	// Wait for the copies still in flight, so the log has every frame
+	for (int i = 0; i < STATS_BUFFERS; i++)
+	{
+		if (statsFences[i]) glClientWaitSync(statsFences[i], GL_SYNC_FLUSH_COMMANDS_BIT, STATS_FENCE_TIMEOUT);
+	}
+	readTileStats();
+
+	deleteTileStatsBuffers();
+
+	if (tileStatsLog.is_open()) tileStatsLog.close();
+}
+
+void captureTileStats(int tileCount, bool clusters, GLuint poolCounterBuffer)
+{
+	GLsync &fence = statsFences[statsSlot];
+	if (!tileStatsBuffer) return;
+
+	// When every readback buffer is still in flight, the oldest copy
+	// is waited for when logging, so the log has every frame. Without
+	// a log, this frame's stats are skipped rather than waited for
+	if (fence)
+	{
+		if (!tileStatsLog.is_open()) return;
+
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, STATS_FENCE_TIMEOUT) == GL_TIMEOUT_EXPIRED);
+		readTileStats();
+	}
+
+	GLintptr offset = statsSlot * (statsCapacity + STATS_COUNTERS) * sizeof(GLuint);
+
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glBindBuffer(GL_COPY_READ_BUFFER, tileStatsBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, statsReadbackBuffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, offset, tileCount * sizeof(GLuint));
+	if (poolCounterBuffer)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, poolCounterBuffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0,
+							offset + statsCapacity * sizeof(GLuint), STATS_COUNTERS * sizeof(GLuint));
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	statsFrames[statsSlot] = getProfilerFrame();
+	statsTiles[statsSlot] = tileCount;
+	statsClusters[statsSlot] = clusters;
+	statsPooled[statsSlot] = poolCounterBuffer != 0;
+	statsSlot = (statsSlot + 1) % STATS_BUFFERS;
+}
+
+void readTileStats()
+{
+	// The next slot to be written holds the oldest copy,
+	// and copies finish in the order they were issued
+	for (int i = 0; i < STATS_BUFFERS; i++)
+	{
+		int slot = (statsSlot + i) % STATS_BUFFERS;
+		GLsync &fence = statsFences[slot];
+		if (!fence) continue;
+
+		GLenum status = glClientWaitSync(fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+
+		glDeleteSync(fence);
+		fence = 0;
+
+		int slotEntries = statsCapacity + STATS_COUNTERS;
+		if (statsRing)
+		{
+			computeTileStats(statsRing + slot * slotEntries, slot);
+		}
+		else
+		{
+			vector<GLuint> entries(slotEntries);
+			glBindBuffer(GL_COPY_READ_BUFFER, statsReadbackBuffer);
+			glGetBufferSubData(GL_COPY_READ_BUFFER, slot * slotEntries * sizeof(GLuint),
+							   slotEntries * sizeof(GLuint), &entries[0]);
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+			computeTileStats(&entries[0], slot);
+		}
+	}
+}
+
+const TileStats &getTileStats()
+{
+	return tileStats;
+}
+
+void resetDropRate()
+{
+	listEntries = 0.0;
+	droppedEntries = 0.0;
+}
+
+double getDropRate()
+{
+	return listEntries > 0.0? droppedEntries / listEntries: 0.0;
+}
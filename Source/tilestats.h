@@ -0,0 +1,44 @@
+#ifndef _TILESTATS_H_INCLUDED_
+#define _TILESTATS_H_INCLUDED_
+
+#include "main.h"
+
+// Set in a tile's entry when lightCull.cs or clusterCull.cs had to
+// drop some of its lights, see Shaders/tileStats.in
+const GLuint TILE_OVERFLOW_BIT = 0x80000000u;
+
+// Light counts over every tile of one frame, light culling tiles
+// or cluster tiles
+struct TileStats
+{
+	unsigned int frame = 0;
+	bool clusters = false;
+	int tiles = 0;
+	GLuint max = 0;
+	double mean = 0.0;
+	GLuint p99 = 0;
+	int overflowed = 0;
+
+	// Lights the tiles asked for from the shared list pool, read from
+	// the culling pass's counter, which keeps counting past its end
+	GLuint poolLights = 0;
+	// List entries the tiles needed, and the ones cut from full lists
+	GLuint listEntries = 0;
+	GLuint droppedEntries = 0;
+};
+
+void initTileStats(const string &logFilename = "");
+// Room for the entries of up to maxTileCount tiles
+void resizeTileStats(int maxTileCount);
+void clearTileStats();
+// poolCounterBuffer holds the counters of Shaders/listPool.in
+void captureTileStats(int tileCount, bool clusters, GLuint poolCounterBuffer = 0);
+void readTileStats();
+const TileStats &getTileStats();
+
+// Share of the list entries that were cut from full lists, over
+// every frame read back since the last reset
+void resetDropRate();
+double getDropRate();
+
+#endif // _TILESTATS_H_INCLUDED_